@@ -0,0 +1,524 @@
+/*
+  ==============================================================================
+
+    AudioThreadGuard.cpp
+    Opt-in debug trap for heap allocations and blocking calls made while
+    rendering audio.
+    Build with KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS=1 to enable; otherwise
+    the scope marker compiles to nothing.
+
+  ==============================================================================
+*/
+
+#include "AudioThreadGuard.h"
+
+#if KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #include <windows.h>
+#else
+ #include <dlfcn.h>
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include <time.h>
+ #include <unistd.h>
+#endif
+
+namespace AudioThreadGuard
+{
+    namespace
+    {
+        thread_local bool isRealtime = false;
+        std::atomic<ViolationHandler> violationHandler { nullptr };
+
+        void checkCall (const char* what) noexcept
+        {
+            if (! isRealtime)
+                return;
+
+            // Reporting allocates and locks too, so leave the realtime section while we do it
+            ScopedAllowAllocation allowReport;
+            auto report = juce::String (what) + " on the audio thread\n" + juce::SystemStats::getStackBacktrace();
+
+            if (auto handler = violationHandler.load())
+            {
+                handler (report);
+                return;
+            }
+
+            juce::Logger::writeToLog (report);
+            jassertfalse;
+        }
+
+        // malloc and free are hooked as well; the checks here already reported
+        // the call, so the ones underneath are let through
+        void* allocate (std::size_t size)
+        {
+            checkCall ("operator new");
+            ScopedAllowAllocation alreadyChecked;
+
+            if (auto* block = std::malloc (size > 0 ? size : 1))
+                return block;
+
+            throw std::bad_alloc();
+        }
+
+        void deallocate (void* block) noexcept
+        {
+            if (block == nullptr)
+                return;
+
+            checkCall ("operator delete");
+            ScopedAllowAllocation alreadyChecked;
+            std::free (block);
+        }
+    }
+
+    //==============================================================================
+    ScopedRealtimeSection::ScopedRealtimeSection() noexcept  : wasRealtime (isRealtime)   { isRealtime = true; }
+    ScopedRealtimeSection::~ScopedRealtimeSection() noexcept                               { isRealtime = wasRealtime; }
+
+    ScopedAllowAllocation::ScopedAllowAllocation() noexcept  : wasRealtime (isRealtime)   { isRealtime = false; }
+    ScopedAllowAllocation::~ScopedAllowAllocation() noexcept                               { isRealtime = wasRealtime; }
+
+    bool isInRealtimeSection() noexcept                                 { return isRealtime; }
+    void setViolationHandler (ViolationHandler newHandler) noexcept     { violationHandler = newHandler; }
+}
+
+//==============================================================================
+void* operator new (std::size_t size)                                   { return AudioThreadGuard::allocate (size); }
+void* operator new[] (std::size_t size)                                 { return AudioThreadGuard::allocate (size); }
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return AudioThreadGuard::allocate (size); }
+    catch (...) { return nullptr; }
+}
+
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return AudioThreadGuard::allocate (size); }
+    catch (...) { return nullptr; }
+}
+
+void operator delete (void* block) noexcept                             { AudioThreadGuard::deallocate (block); }
+void operator delete[] (void* block) noexcept                           { AudioThreadGuard::deallocate (block); }
+void operator delete (void* block, std::size_t) noexcept                { AudioThreadGuard::deallocate (block); }
+void operator delete[] (void* block, std::size_t) noexcept              { AudioThreadGuard::deallocate (block); }
+void operator delete (void* block, const std::nothrow_t&) noexcept      { AudioThreadGuard::deallocate (block); }
+void operator delete[] (void* block, const std::nothrow_t&) noexcept    { AudioThreadGuard::deallocate (block); }
+
+//==============================================================================
+#if JUCE_WINDOWS
+
+// The hooks replace this module's import table entries, so they see the calls made
+// from code linked into the plugin (JUCE's CriticalSection, WaitableEvent, Thread::sleep,
+// HeapBlock) but not those made inside the C++ runtime or system DLLs.
+namespace AudioThreadGuard
+{
+    namespace
+    {
+        decltype (&EnterCriticalSection) nextEnterCriticalSection = nullptr;
+        decltype (&AcquireSRWLockExclusive) nextAcquireSRWLockExclusive = nullptr;
+        decltype (&AcquireSRWLockShared) nextAcquireSRWLockShared = nullptr;
+        decltype (&SleepConditionVariableSRW) nextSleepConditionVariableSRW = nullptr;
+        decltype (&WaitForSingleObject) nextWaitForSingleObject = nullptr;
+        decltype (&WaitForSingleObjectEx) nextWaitForSingleObjectEx = nullptr;
+        decltype (&Sleep) nextSleep = nullptr;
+        decltype (&malloc) nextMalloc = nullptr;
+        decltype (&calloc) nextCalloc = nullptr;
+        decltype (&realloc) nextRealloc = nullptr;
+        decltype (&free) nextFree = nullptr;
+        decltype (&_aligned_malloc) nextAlignedMalloc = nullptr;
+        decltype (&_aligned_free) nextAlignedFree = nullptr;
+
+        void WINAPI hookedEnterCriticalSection (LPCRITICAL_SECTION section)
+        {
+            checkCall ("EnterCriticalSection");
+            nextEnterCriticalSection (section);
+        }
+
+        void WINAPI hookedAcquireSRWLockExclusive (PSRWLOCK lock)
+        {
+            checkCall ("AcquireSRWLockExclusive");
+            nextAcquireSRWLockExclusive (lock);
+        }
+
+        void WINAPI hookedAcquireSRWLockShared (PSRWLOCK lock)
+        {
+            checkCall ("AcquireSRWLockShared");
+            nextAcquireSRWLockShared (lock);
+        }
+
+        BOOL WINAPI hookedSleepConditionVariableSRW (PCONDITION_VARIABLE condition, PSRWLOCK lock, DWORD milliseconds, ULONG flags)
+        {
+            checkCall ("SleepConditionVariableSRW");
+            return nextSleepConditionVariableSRW (condition, lock, milliseconds, flags);
+        }
+
+        // A zero timeout only polls, so it isn't reported
+        DWORD WINAPI hookedWaitForSingleObject (HANDLE handle, DWORD milliseconds)
+        {
+            if (milliseconds != 0)
+                checkCall ("WaitForSingleObject");
+
+            return nextWaitForSingleObject (handle, milliseconds);
+        }
+
+        DWORD WINAPI hookedWaitForSingleObjectEx (HANDLE handle, DWORD milliseconds, BOOL alertable)
+        {
+            if (milliseconds != 0)
+                checkCall ("WaitForSingleObjectEx");
+
+            return nextWaitForSingleObjectEx (handle, milliseconds, alertable);
+        }
+
+        void WINAPI hookedSleep (DWORD milliseconds)
+        {
+            checkCall ("Sleep");
+            nextSleep (milliseconds);
+        }
+
+        // The CRT heap, which juce::HeapBlock (and so Array, AudioBuffer and MemoryBlock) uses
+        // directly. Only imported when the plugin links the DLL runtime (/MD); with the static
+        // runtime these calls never go through the import table and aren't seen.
+        void* __cdecl hookedMalloc (size_t size)
+        {
+            checkCall ("malloc");
+            return nextMalloc (size);
+        }
+
+        void* __cdecl hookedCalloc (size_t count, size_t size)
+        {
+            checkCall ("calloc");
+            return nextCalloc (count, size);
+        }
+
+        void* __cdecl hookedRealloc (void* block, size_t size)
+        {
+            checkCall ("realloc");
+            return nextRealloc (block, size);
+        }
+
+        void __cdecl hookedFree (void* block)
+        {
+            if (block != nullptr)
+                checkCall ("free");
+
+            nextFree (block);
+        }
+
+        void* __cdecl hookedAlignedMalloc (size_t size, size_t alignment)
+        {
+            checkCall ("_aligned_malloc");
+            return nextAlignedMalloc (size, alignment);
+        }
+
+        void __cdecl hookedAlignedFree (void* block)
+        {
+            if (block != nullptr)
+                checkCall ("_aligned_free");
+
+            nextAlignedFree (block);
+        }
+
+        /** Points every import of functionName in the module at the hook, keeping the original in next. */
+        template <typename Function>
+        void patchImport (HMODULE module, const char* functionName, Function hook, Function& next)
+        {
+            auto* base = reinterpret_cast<BYTE*> (module);
+            auto* ntHeaders = reinterpret_cast<IMAGE_NT_HEADERS*> (base + reinterpret_cast<IMAGE_DOS_HEADER*> (base)->e_lfanew);
+            auto& imports = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+
+            if (imports.VirtualAddress == 0)
+                return;
+
+            for (auto* library = reinterpret_cast<IMAGE_IMPORT_DESCRIPTOR*> (base + imports.VirtualAddress); library->Name != 0; ++library)
+            {
+                if (library->OriginalFirstThunk == 0)
+                    continue;
+
+                auto* names = reinterpret_cast<IMAGE_THUNK_DATA*> (base + library->OriginalFirstThunk);
+                auto* addresses = reinterpret_cast<IMAGE_THUNK_DATA*> (base + library->FirstThunk);
+
+                for (; names->u1.AddressOfData != 0; ++names, ++addresses)
+                {
+                    if (IMAGE_SNAP_BY_ORDINAL (names->u1.Ordinal))
+                        continue;
+
+                    auto* import = reinterpret_cast<IMAGE_IMPORT_BY_NAME*> (base + names->u1.AddressOfData);
+                    if (std::strcmp (reinterpret_cast<const char*> (import->Name), functionName) != 0)
+                        continue;
+
+                    DWORD protection = 0;
+                    VirtualProtect (&addresses->u1.Function, sizeof (addresses->u1.Function), PAGE_READWRITE, &protection);
+                    next = reinterpret_cast<Function> (addresses->u1.Function);
+                    addresses->u1.Function = reinterpret_cast<decltype (addresses->u1.Function)> (hook);
+                    VirtualProtect (&addresses->u1.Function, sizeof (addresses->u1.Function), protection, &protection);
+                }
+            }
+        }
+
+        struct ImportHooks
+        {
+            ImportHooks()
+            {
+                HMODULE module = nullptr;
+
+                if (! GetModuleHandleExW (GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                          reinterpret_cast<LPCWSTR> (&hookedSleep), &module))
+                    return;
+
+                patchImport (module, "EnterCriticalSection", &hookedEnterCriticalSection, nextEnterCriticalSection);
+                patchImport (module, "AcquireSRWLockExclusive", &hookedAcquireSRWLockExclusive, nextAcquireSRWLockExclusive);
+                patchImport (module, "AcquireSRWLockShared", &hookedAcquireSRWLockShared, nextAcquireSRWLockShared);
+                patchImport (module, "SleepConditionVariableSRW", &hookedSleepConditionVariableSRW, nextSleepConditionVariableSRW);
+                patchImport (module, "WaitForSingleObject", &hookedWaitForSingleObject, nextWaitForSingleObject);
+                patchImport (module, "WaitForSingleObjectEx", &hookedWaitForSingleObjectEx, nextWaitForSingleObjectEx);
+                patchImport (module, "Sleep", &hookedSleep, nextSleep);
+                patchImport (module, "malloc", &hookedMalloc, nextMalloc);
+                patchImport (module, "calloc", &hookedCalloc, nextCalloc);
+                patchImport (module, "realloc", &hookedRealloc, nextRealloc);
+                patchImport (module, "free", &hookedFree, nextFree);
+                patchImport (module, "_aligned_malloc", &hookedAlignedMalloc, nextAlignedMalloc);
+                patchImport (module, "_aligned_free", &hookedAlignedFree, nextAlignedFree);
+            }
+        };
+
+        const ImportHooks importHooks;
+    }
+}
+
+#else
+
+// These definitions take precedence over libc's for calls made from this binary, and
+// forward to the next definition in the lookup order. In a test executable on Linux
+// they also see the calls made from shared libraries such as libstdc++.
+namespace AudioThreadGuard
+{
+    namespace
+    {
+        // dlsym may allocate while a hook is looking up libc's allocator, before there
+        // is one to forward to. Those few early blocks come from here and are never freed.
+        alignas (std::max_align_t) char bootstrapArena[4096];
+        std::atomic<size_t> bootstrapArenaUsed { 0 };
+        thread_local bool resolvingSymbol = false;
+
+        void* allocateFromBootstrapArena (size_t size) noexcept
+        {
+            constexpr auto alignment = alignof (std::max_align_t);
+            size = (size + alignment - 1) & ~(alignment - 1);
+
+            auto offset = bootstrapArenaUsed.fetch_add (size);
+            return offset + size <= sizeof (bootstrapArena) ? bootstrapArena + offset : nullptr;
+        }
+
+        bool isFromBootstrapArena (const void* block) noexcept
+        {
+            auto* bytes = static_cast<const char*> (block);
+            return bytes >= bootstrapArena && bytes < bootstrapArena + sizeof (bootstrapArena);
+        }
+
+        /** Looks up the definition being wrapped on first use. dlsym doesn't take any of
+            the hooked locks, and allocations it makes meanwhile go to the bootstrap arena,
+            so it's safe to call from inside a hook.
+        */
+        template <typename Function>
+        Function getNext (std::atomic<void*>& next, const char* name, const char* version = nullptr) noexcept
+        {
+            auto* symbol = next.load (std::memory_order_relaxed);
+
+            if (symbol == nullptr)
+            {
+                resolvingSymbol = true;
+
+               #if defined (__GLIBC__)
+                // glibc keeps an old pthread_cond_* ABI around, which plain dlsym would return
+                if (version != nullptr)
+                    symbol = dlvsym (RTLD_NEXT, name, version);
+               #else
+                juce::ignoreUnused (version);
+               #endif
+
+                if (symbol == nullptr)
+                    symbol = dlsym (RTLD_NEXT, name);
+
+                resolvingSymbol = false;
+                next.store (symbol, std::memory_order_relaxed);
+            }
+
+            return reinterpret_cast<Function> (symbol);
+        }
+    }
+}
+
+// glibc declares the allocator and lock functions noexcept in C++, and a redefinition has to match
+#if defined (__THROW)
+ #define KANNEN_LIBC_NOTHROW __THROW
+#else
+ #define KANNEN_LIBC_NOTHROW
+#endif
+
+// The heap, which juce::HeapBlock (and so Array, AudioBuffer and MemoryBlock) calls directly
+extern "C" void* malloc (size_t size) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+
+    if (AudioThreadGuard::resolvingSymbol)
+        return AudioThreadGuard::allocateFromBootstrapArena (size);
+
+    AudioThreadGuard::checkCall ("malloc");
+    return AudioThreadGuard::getNext<void* (*) (size_t)> (next, "malloc") (size);
+}
+
+extern "C" void* calloc (size_t count, size_t size) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+
+    // The arena is static, so already zeroed
+    if (AudioThreadGuard::resolvingSymbol)
+        return count != 0 && size > (size_t) -1 / count ? nullptr : AudioThreadGuard::allocateFromBootstrapArena (count * size);
+
+    AudioThreadGuard::checkCall ("calloc");
+    return AudioThreadGuard::getNext<void* (*) (size_t, size_t)> (next, "calloc") (count, size);
+}
+
+extern "C" void* realloc (void* block, size_t size) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+
+    if (AudioThreadGuard::resolvingSymbol)
+        return AudioThreadGuard::allocateFromBootstrapArena (size);
+
+    AudioThreadGuard::checkCall ("realloc");
+
+    // libc doesn't know the arena's blocks, so move them out by hand
+    if (block != nullptr && AudioThreadGuard::isFromBootstrapArena (block))
+    {
+        auto* moved = malloc (size);
+        auto available = (size_t) (AudioThreadGuard::bootstrapArena + sizeof (AudioThreadGuard::bootstrapArena) - static_cast<char*> (block));
+
+        if (moved != nullptr)
+            std::memcpy (moved, block, juce::jmin (size, available));
+
+        return moved;
+    }
+
+    return AudioThreadGuard::getNext<void* (*) (void*, size_t)> (next, "realloc") (block, size);
+}
+
+extern "C" void free (void* block) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+
+    if (block == nullptr || AudioThreadGuard::isFromBootstrapArena (block))
+        return;
+
+    AudioThreadGuard::checkCall ("free");
+    AudioThreadGuard::getNext<void (*) (void*)> (next, "free") (block);
+}
+
+extern "C" int posix_memalign (void** block, size_t alignment, size_t size) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("posix_memalign");
+    return AudioThreadGuard::getNext<int (*) (void**, size_t, size_t)> (next, "posix_memalign") (block, alignment, size);
+}
+
+extern "C" void* aligned_alloc (size_t alignment, size_t size) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("aligned_alloc");
+    return AudioThreadGuard::getNext<void* (*) (size_t, size_t)> (next, "aligned_alloc") (alignment, size);
+}
+
+//==============================================================================
+
+extern "C" int pthread_mutex_lock (pthread_mutex_t* mutex) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("pthread_mutex_lock");
+    return AudioThreadGuard::getNext<int (*) (pthread_mutex_t*)> (next, "pthread_mutex_lock") (mutex);
+}
+
+extern "C" int pthread_rwlock_rdlock (pthread_rwlock_t* lock) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("pthread_rwlock_rdlock");
+    return AudioThreadGuard::getNext<int (*) (pthread_rwlock_t*)> (next, "pthread_rwlock_rdlock") (lock);
+}
+
+extern "C" int pthread_rwlock_wrlock (pthread_rwlock_t* lock) KANNEN_LIBC_NOTHROW
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("pthread_rwlock_wrlock");
+    return AudioThreadGuard::getNext<int (*) (pthread_rwlock_t*)> (next, "pthread_rwlock_wrlock") (lock);
+}
+
+extern "C" int pthread_cond_wait (pthread_cond_t* condition, pthread_mutex_t* mutex)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("pthread_cond_wait");
+    return AudioThreadGuard::getNext<int (*) (pthread_cond_t*, pthread_mutex_t*)> (next, "pthread_cond_wait", "GLIBC_2.3.2") (condition, mutex);
+}
+
+extern "C" int pthread_cond_timedwait (pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("pthread_cond_timedwait");
+    return AudioThreadGuard::getNext<int (*) (pthread_cond_t*, pthread_mutex_t*, const struct timespec*)> (next, "pthread_cond_timedwait", "GLIBC_2.3.2") (condition, mutex, time);
+}
+
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 30)
+// What libstdc++'s condition_variable::wait_for and wait_until use on newer glibc
+extern "C" int pthread_cond_clockwait (pthread_cond_t* condition, pthread_mutex_t* mutex, clockid_t clock, const struct timespec* time)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("pthread_cond_clockwait");
+    return AudioThreadGuard::getNext<int (*) (pthread_cond_t*, pthread_mutex_t*, clockid_t, const struct timespec*)> (next, "pthread_cond_clockwait") (condition, mutex, clock, time);
+}
+#endif
+
+extern "C" int sem_wait (sem_t* semaphore)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("sem_wait");
+    return AudioThreadGuard::getNext<int (*) (sem_t*)> (next, "sem_wait") (semaphore);
+}
+
+#if ! JUCE_MAC
+extern "C" int sem_timedwait (sem_t* semaphore, const struct timespec* time)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("sem_timedwait");
+    return AudioThreadGuard::getNext<int (*) (sem_t*, const struct timespec*)> (next, "sem_timedwait") (semaphore, time);
+}
+#endif
+
+extern "C" int nanosleep (const struct timespec* duration, struct timespec* remaining)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("nanosleep");
+    return AudioThreadGuard::getNext<int (*) (const struct timespec*, struct timespec*)> (next, "nanosleep") (duration, remaining);
+}
+
+extern "C" int usleep (useconds_t microseconds)
+{
+    static std::atomic<void*> next { nullptr };
+    AudioThreadGuard::checkCall ("usleep");
+    return AudioThreadGuard::getNext<int (*) (useconds_t)> (next, "usleep") (microseconds);
+}
+
+#undef KANNEN_LIBC_NOTHROW
+
+#endif
+
+#endif
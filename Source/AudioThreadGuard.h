@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+
+    AudioThreadGuard.h
+    Opt-in debug trap for heap allocations and blocking calls made while
+    rendering audio.
+    Build with KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS=1 to enable; otherwise
+    the scope marker compiles to nothing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#ifndef KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+ #define KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS 0
+#endif
+
+#if KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+
+//==============================================================================
+/**
+    The global operator new and delete are replaced and the C heap functions
+    hooked, and any call made while a ScopedRealtimeSection is open on the
+    calling thread logs a stack trace and hits a jassert. That includes the
+    malloc/realloc/free that juce::HeapBlock, and so Array, AudioBuffer and
+    MemoryBlock, call directly. Run the plugin in a debug host with automation
+    and varying block sizes and every allocation on the render path stops in
+    the debugger.
+
+    The blocking lock, wait and sleep entry points are hooked the same way:
+    pthread mutexes, rwlocks, condition variables, semaphores and sleeps on
+    Linux and macOS, critical sections, SRW locks, waits and sleeps on Windows.
+    Only calls made from code built into this binary are seen on macOS and
+    Windows, so allocations and locks inside other libraries still need review
+    there. On Windows the heap is only seen with the DLL C runtime (/MD).
+*/
+namespace AudioThreadGuard
+{
+    class ScopedRealtimeSection
+    {
+    public:
+        ScopedRealtimeSection() noexcept;
+        ~ScopedRealtimeSection() noexcept;
+
+    private:
+        bool wasRealtime;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedRealtimeSection)
+    };
+
+    /** Lets a section that is allowed to allocate (e.g. a one-off report) run inside a realtime one. */
+    class ScopedAllowAllocation
+    {
+    public:
+        ScopedAllowAllocation() noexcept;
+        ~ScopedAllowAllocation() noexcept;
+
+    private:
+        bool wasRealtime;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedAllowAllocation)
+    };
+
+    /** True while a ScopedRealtimeSection is open on the calling thread. */
+    bool isInRealtimeSection() noexcept;
+
+    /** Receives what went wrong plus a stack trace. It runs outside the realtime section. */
+    using ViolationHandler = void (*) (const juce::String& report);
+
+    /** Replaces the default handler, which logs the report and hits a jassert.
+        Pass nullptr to restore it. Tests use this to count violations instead.
+    */
+    void setViolationHandler (ViolationHandler newHandler) noexcept;
+}
+
+ #define KANNEN_REALTIME_SECTION  const AudioThreadGuard::ScopedRealtimeSection JUCE_JOIN_MACRO (kannenRealtimeSection, __LINE__);
+
+#else
+
+ #define KANNEN_REALTIME_SECTION
+
+#endif
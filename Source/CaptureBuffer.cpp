@@ -0,0 +1,22 @@
+/*
+  ==============================================================================
+
+    CaptureBuffer.cpp
+    Stereo capture ring stored as interleaved frames, so a grain reading
+    both channels touches one cache line per frame instead of two.
+
+  ==============================================================================
+*/
+
+#include "CaptureBuffer.h"
+
+void CaptureBuffer::setSize (int numFramesToUse)
+{
+    numFrames = juce::jmax (0, numFramesToUse);
+    samples.assign ((size_t) (numFrames * numChannels), 0.0f);
+}
+
+void CaptureBuffer::clear()
+{
+    std::fill (samples.begin(), samples.end(), 0.0f);
+}
@@ -0,0 +1,52 @@
+/*
+  ==============================================================================
+
+    CaptureBuffer.h
+    Stereo capture ring stored as interleaved frames, so a grain reading
+    both channels touches one cache line per frame instead of two.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    The capture always holds stereo frames laid out L R L R. Single-channel
+    readers take getChannelData() and step by numChannels; stereo readers take
+    getFrames() and read both channels of a frame from adjacent floats.
+*/
+class CaptureBuffer
+{
+public:
+    static constexpr int numChannels = 2;
+
+    CaptureBuffer() = default;
+
+    /** Resizes and clears. Allocates, so call from prepareToPlay(). */
+    void setSize (int numFramesToUse);
+    void clear();
+
+    int getNumFrames() const noexcept                       { return numFrames; }
+
+    /** Interleaved frames; sample n of channel c is at [n * numChannels + c]. */
+    const float* getFrames() const noexcept                 { return samples.data(); }
+    float* getWriteFrames() noexcept                        { return samples.data(); }
+
+    /** First sample of a channel. Consecutive samples are numChannels floats apart. */
+    const float* getChannelData (int channel) const noexcept
+    {
+        jassert (juce::isPositiveAndBelow (channel, numChannels));
+        return samples.data() + channel;
+    }
+
+    float getSample (int channel, int frame) const noexcept  { return samples[(size_t) (frame * numChannels + channel)]; }
+
+private:
+    std::vector<float> samples;
+    int numFrames = 0;
+
+    JUCE_LEAK_DETECTOR (CaptureBuffer)
+};
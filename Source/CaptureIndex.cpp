@@ -0,0 +1,258 @@
+/*
+  ==============================================================================
+
+    CaptureIndex.cpp
+    Incremental per-segment analysis of the capture buffer (onsets, RMS and
+    spectral centroid) so grains can be placed on interesting material
+    without rescanning the buffer.
+
+  ==============================================================================
+*/
+
+#include "CaptureIndex.h"
+
+namespace
+{
+    constexpr int fftOrder = 8;
+    static_assert ((1 << fftOrder) == CaptureIndex::segmentSize, "One FFT frame per segment");
+
+    constexpr float silenceThreshold = 1.0e-4f;   // -80 dBFS
+    constexpr float onsetSensitivity = 1.5f;      // flux must exceed this multiple of its running mean
+    constexpr float fluxAveraging = 0.1f;
+    constexpr float lowestCentroidHz = 50.0f;
+    constexpr float highestCentroidHz = 16000.0f;
+}
+
+//==============================================================================
+void CaptureIndex::FenwickTree::resize (int size)
+{
+    tree.assign ((size_t) size + 1, 0.0);
+    highestPowerOfTwo = juce::nextPowerOfTwo (size + 1) / 2;
+    total = 0.0;
+}
+
+void CaptureIndex::FenwickTree::clear()
+{
+    std::fill (tree.begin(), tree.end(), 0.0);
+    total = 0.0;
+}
+
+void CaptureIndex::FenwickTree::add (int index, double delta)
+{
+    total += delta;
+
+    for (auto i = (size_t) index + 1; i < tree.size(); i += i & (~i + 1))
+        tree[i] += delta;
+}
+
+double CaptureIndex::FenwickTree::getTotal() const
+{
+    return total;
+}
+
+int CaptureIndex::FenwickTree::find (double target) const
+{
+    size_t position = 0;
+
+    for (auto step = (size_t) highestPowerOfTwo; step > 0; step >>= 1)
+    {
+        if (position + step < tree.size() && tree[position + step] <= target)
+        {
+            position += step;
+            target -= tree[position];
+        }
+    }
+
+    return juce::jmin ((int) position, (int) tree.size() - 2);
+}
+
+//==============================================================================
+CaptureIndex::CaptureIndex()
+    : fft (fftOrder),
+      window (sharedTables->getTable (SharedDspTables::TableType::hannWindow, segmentSize))
+{
+    fftData.resize (2 * segmentSize);
+    previousMagnitudes.resize (segmentSize / 2 + 1);
+}
+
+void CaptureIndex::prepare (double sampleRate, int captureLength)
+{
+    currentSampleRate = sampleRate;
+    numSegments = captureLength / segmentSize;
+
+    segments.resize ((size_t) numSegments);
+    loudness.resize (numSegments);
+    onsets.resize (numSegments);
+
+    for (auto& band : centroidBands)
+        band.resize (numSegments);
+
+    reset();
+}
+
+void CaptureIndex::reset()
+{
+    std::fill (segments.begin(), segments.end(), Segment());
+    std::fill (previousMagnitudes.begin(), previousMagnitudes.end(), 0.0f);
+
+    loudness.clear();
+    onsets.clear();
+
+    for (auto& band : centroidBands)
+        band.clear();
+
+    analysedUpTo = 0;
+    meanFlux = 0.0f;
+}
+
+//==============================================================================
+void CaptureIndex::update (const CaptureBuffer& capture, int writePosition)
+{
+    auto indexedLength = numSegments * segmentSize;
+
+    for (int analysed = 0; analysed < numSegments; ++analysed)
+    {
+        if (analysedUpTo >= indexedLength)
+        {
+            // The samples past the last whole segment are never indexed
+            if (writePosition >= analysedUpTo)
+                break;
+
+            analysedUpTo = 0;
+        }
+
+        auto segmentEnd = analysedUpTo + segmentSize;
+        auto complete = writePosition < analysedUpTo || writePosition >= segmentEnd;
+
+        if (! complete)
+            break;
+
+        analyseSegment (capture, analysedUpTo / segmentSize);
+        analysedUpTo = segmentEnd;
+    }
+}
+
+void CaptureIndex::analyseSegment (const CaptureBuffer& capture, int segmentIndex)
+{
+    constexpr auto numChannels = CaptureBuffer::numChannels;
+    constexpr auto channelScale = 1.0f / (float) numChannels;
+
+    // Downmix the segment's frames, reading each frame once
+    const float* frames = capture.getFrames() + segmentIndex * segmentSize * numChannels;
+
+    std::fill (fftData.begin(), fftData.end(), 0.0f);
+
+    for (int n = 0; n < segmentSize; ++n)
+        for (int channel = 0; channel < numChannels; ++channel)
+            fftData[(size_t) n] += frames[n * numChannels + channel] * channelScale;
+
+    const float* windowData = window->getData();
+    float sumOfSquares = 0.0f;
+    for (int n = 0; n < segmentSize; ++n)
+    {
+        sumOfSquares += fftData[(size_t) n] * fftData[(size_t) n];
+        fftData[(size_t) n] *= windowData[n];
+    }
+
+    auto rms = std::sqrt (sumOfSquares / (float) segmentSize);
+
+    fft.performFrequencyOnlyForwardTransform (fftData.data());
+
+    float flux = 0.0f, weightedSum = 0.0f, magnitudeSum = 0.0f;
+    for (size_t k = 1; k < previousMagnitudes.size(); ++k)
+    {
+        auto magnitude = fftData[k];
+        flux += juce::jmax (0.0f, magnitude - previousMagnitudes[k]);
+        weightedSum += (float) k * magnitude;
+        magnitudeSum += magnitude;
+        previousMagnitudes[k] = magnitude;
+    }
+
+    auto onsetStrength = juce::jmax (0.0f, flux - onsetSensitivity * meanFlux);
+    meanFlux += fluxAveraging * (flux - meanFlux);
+
+    auto centroidBand = -1;
+    if (rms > silenceThreshold && magnitudeSum > 0.0f)
+        centroidBand = getCentroidBand ((weightedSum / magnitudeSum) * (float) currentSampleRate / (float) segmentSize);
+    else
+        onsetStrength = 0.0f;
+
+    auto& segment = segments[(size_t) segmentIndex];
+
+    loudness.add (segmentIndex, rms - segment.rms);
+    onsets.add (segmentIndex, onsetStrength - segment.onsetStrength);
+
+    if (centroidBand != segment.centroidBand)
+    {
+        if (segment.centroidBand >= 0)
+            centroidBands[(size_t) segment.centroidBand].add (segmentIndex, -1.0);
+
+        if (centroidBand >= 0)
+            centroidBands[(size_t) centroidBand].add (segmentIndex, 1.0);
+    }
+
+    segment.rms = rms;
+    segment.onsetStrength = onsetStrength;
+    segment.centroidBand = centroidBand;
+}
+
+int CaptureIndex::getCentroidBand (float centroidHz) const
+{
+    auto highest = juce::jmin (highestCentroidHz, (float) currentSampleRate * 0.5f);
+    auto proportion = std::log (juce::jmax (centroidHz, lowestCentroidHz) / lowestCentroidHz)
+                        / std::log (highest / lowestCentroidHz);
+
+    return juce::jlimit (0, numCentroidBands - 1, (int) (proportion * numCentroidBands));
+}
+
+//==============================================================================
+int CaptureIndex::findPosition (Placement placement, float centroidHz, juce::Random& random) const
+{
+    // Weighted pick of a segment, or -1 if the tree holds no weight
+    auto pickSegment = [&random] (const FenwickTree& tree)
+    {
+        auto total = tree.getTotal();
+        return total > 1.0e-6 ? tree.find (random.nextDouble() * total) : -1;
+    };
+
+    switch (placement)
+    {
+        case Placement::onsets:
+        {
+            // Start right on the attack
+            auto segment = pickSegment (onsets);
+            return segment >= 0 ? segment * segmentSize : -1;
+        }
+
+        case Placement::loud:
+        {
+            auto segment = pickSegment (loudness);
+            return segment >= 0 ? segment * segmentSize + random.nextInt (segmentSize) : -1;
+        }
+
+        case Placement::centroid:
+        {
+            // Nearest non-empty band to the requested centroid
+            auto targetBand = getCentroidBand (centroidHz);
+
+            for (int distance = 0; distance < numCentroidBands; ++distance)
+            {
+                for (auto band : { targetBand - distance, targetBand + distance })
+                {
+                    if (band < 0 || band >= numCentroidBands)
+                        continue;
+
+                    auto segment = pickSegment (centroidBands[(size_t) band]);
+                    if (segment >= 0)
+                        return segment * segmentSize + random.nextInt (segmentSize);
+                }
+            }
+
+            return -1;
+        }
+
+        case Placement::random:
+        default:
+            return -1;
+    }
+}
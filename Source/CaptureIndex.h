@@ -0,0 +1,93 @@
+/*
+  ==============================================================================
+
+    CaptureIndex.h
+    Incremental per-segment analysis of the capture buffer (onsets, RMS and
+    spectral centroid) so grains can be placed on interesting material
+    without rescanning the buffer.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SharedDspTables.h"
+#include "CaptureBuffer.h"
+
+//==============================================================================
+/**
+    Splits the capture buffer into fixed-size segments and analyses each one
+    as soon as the write head has passed it. Weighted lookups go through
+    Fenwick trees, so placing a grain costs O(log n) in the number of segments.
+*/
+class CaptureIndex
+{
+public:
+    static constexpr int segmentSize = 256;
+    static constexpr int numCentroidBands = 16;
+
+    enum class Placement
+    {
+        random = 0,
+        onsets,
+        loud,
+        centroid
+    };
+
+    CaptureIndex();
+
+    void prepare (double sampleRate, int captureLength);
+    void reset();
+
+    /** Analyses every segment the write head has completed since the last call. */
+    void update (const CaptureBuffer& capture, int writePosition);
+
+    /** Picks a capture position for a grain, or returns -1 if nothing in the
+        index matches (e.g. no onsets yet) and the caller should fall back to
+        a uniform position.
+    */
+    int findPosition (Placement placement, float centroidHz, juce::Random& random) const;
+
+private:
+    struct FenwickTree
+    {
+        void resize (int size);
+        void clear();
+        void add (int index, double delta);
+        double getTotal() const;
+
+        /** Index of the first element whose prefix sum exceeds target. */
+        int find (double target) const;
+
+        std::vector<double> tree;
+        double total = 0.0;
+        int highestPowerOfTwo = 0;
+    };
+
+    struct Segment
+    {
+        float rms = 0.0f;
+        float onsetStrength = 0.0f;
+        int centroidBand = -1;
+    };
+
+    void analyseSegment (const CaptureBuffer& capture, int segmentIndex);
+    int getCentroidBand (float centroidHz) const;
+
+    juce::SharedResourcePointer<SharedDspTables> sharedTables;
+    juce::dsp::FFT fft;
+    std::shared_ptr<const DspTable> window;
+    std::vector<float> fftData, previousMagnitudes;
+
+    std::vector<Segment> segments;
+    FenwickTree loudness, onsets;
+    std::array<FenwickTree, numCentroidBands> centroidBands;
+
+    double currentSampleRate = 44100.0;
+    int numSegments = 0;
+    int analysedUpTo = 0;
+    float meanFlux = 0.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CaptureIndex)
+};
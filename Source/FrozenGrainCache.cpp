@@ -0,0 +1,460 @@
+/*
+  ==============================================================================
+
+    FrozenGrainCache.cpp
+    Background pre-rendering of grains from a frozen capture, so dense frozen
+    pads mix cached grains instead of interpolating and enveloping each one.
+
+  ==============================================================================
+*/
+
+#include "FrozenGrainCache.h"
+#include "Profiler.h"
+
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX    // keeps std::numeric_limits<>::max() below usable
+ #endif
+ #include <windows.h>
+#elif JUCE_MAC || JUCE_IOS
+ #include <dispatch/dispatch.h>
+#else
+ #include <cerrno>
+ #include <semaphore.h>
+#endif
+
+//==============================================================================
+// Counting semaphore whose post never takes a lock, so the audio thread can wake
+// the worker. juce::WaitableEvent signals under a mutex, which this avoids.
+class FrozenGrainCache::WorkSemaphore
+{
+public:
+   #if JUCE_WINDOWS
+    WorkSemaphore()           { handle = CreateSemaphoreW (nullptr, 0, 0x7fffffff, nullptr); }
+    ~WorkSemaphore()          { CloseHandle (handle); }
+    void post() noexcept      { ReleaseSemaphore (handle, 1, nullptr); }
+    void wait() noexcept      { WaitForSingleObject (handle, INFINITE); }
+
+   private:
+    HANDLE handle;
+   #elif JUCE_MAC || JUCE_IOS
+    WorkSemaphore()           { semaphore = dispatch_semaphore_create (0); }
+    ~WorkSemaphore()          { dispatch_release (semaphore); }
+    void post() noexcept      { dispatch_semaphore_signal (semaphore); }
+    void wait() noexcept      { dispatch_semaphore_wait (semaphore, DISPATCH_TIME_FOREVER); }
+
+   private:
+    dispatch_semaphore_t semaphore;
+   #else
+    WorkSemaphore()           { sem_init (&semaphore, 0, 0); }
+    ~WorkSemaphore()          { sem_destroy (&semaphore); }
+    void post() noexcept      { sem_post (&semaphore); }
+    void wait() noexcept      { while (sem_wait (&semaphore) != 0 && errno == EINTR) {} }
+
+   private:
+    sem_t semaphore;
+   #endif
+
+    JUCE_DECLARE_NON_COPYABLE (WorkSemaphore)
+};
+
+namespace
+{
+    // Key layout, low to high: position (7 bits), duration (7), pitch in cents + 1200 (12),
+    // direction (1), channel (1), envelope (2), interpolation (1), stereo link (1), then the
+    // generation (24 bits from bit 32), the source capture (1 bit at 56) and a valid flag in
+    // the top bit so no real key is 0.
+    constexpr int pitchRangeCents = 1200;
+    constexpr int generationShift = 32;
+    constexpr juce::uint64 generationMask = 0xffffffull;
+    constexpr int sourceShift = 56;
+    constexpr juce::uint64 validFlag = 1ull << 63;
+
+    struct KeyFields
+    {
+        int positionStep, durationStep, pitchCents, direction, channel, envelopeShape, interpolation, stereoLinked, source;
+    };
+
+    juce::uint64 packKey (const KeyFields& f)
+    {
+        return (juce::uint64) f.positionStep
+             | (juce::uint64) f.durationStep << 7
+             | (juce::uint64) (f.pitchCents + pitchRangeCents) << 14
+             | (juce::uint64) (f.direction > 0 ? 1 : 0) << 26
+             | (juce::uint64) f.channel << 27
+             | (juce::uint64) f.envelopeShape << 28
+             | (juce::uint64) f.interpolation << 30
+             | (juce::uint64) f.stereoLinked << 31
+             | (juce::uint64) f.source << sourceShift;
+    }
+
+    KeyFields unpackKey (juce::uint64 key)
+    {
+        return { (int) (key & 0x7f),
+                 (int) ((key >> 7) & 0x7f),
+                 (int) ((key >> 14) & 0xfff) - pitchRangeCents,
+                 ((key >> 26) & 1) != 0 ? 1 : -1,
+                 (int) ((key >> 27) & 1),
+                 (int) ((key >> 28) & 3),
+                 (int) ((key >> 30) & 1),
+                 (int) ((key >> 31) & 1),
+                 (int) ((key >> sourceShift) & 1) };
+    }
+}
+
+//==============================================================================
+FrozenGrainCache::FrozenGrainCache()
+    : juce::Thread ("Frozen Grain Cache"),
+      workAvailable (std::make_unique<WorkSemaphore>())
+{
+}
+
+FrozenGrainCache::~FrozenGrainCache()
+{
+    stop();
+}
+
+void FrozenGrainCache::prepare (const CaptureBuffer& mainCapture, const CaptureBuffer& sidechainCapture,
+                                std::shared_ptr<const DspTable> envelopeTable, double sampleRate)
+{
+    stop();
+
+    jassert (mainCapture.getNumFrames() == sidechainCapture.getNumFrames());
+    captures = { &mainCapture, &sidechainCapture };
+    envelope = std::move (envelopeTable);
+    currentSampleRate = sampleRate;
+
+    requestFifo.reset();
+    useCounter = 0;
+    captureFrozen = false;
+
+    startThread (juce::Thread::Priority::low);
+}
+
+void FrozenGrainCache::stop()
+{
+    signalThreadShouldExit();
+    workAvailable->post();
+    stopThread (1000);
+
+    // The audio has stopped too, so nothing plays from the slots
+    numSlots = 0;
+
+    for (auto& slot : slots)
+    {
+        slot.key = 0;
+        slot.users = 0;
+        slot.lastUsed = 0;
+        slot.samples = nullptr;
+    }
+
+    std::vector<float>().swap (pool);
+    slotLength = 0;
+    slotChannels = 0;
+}
+
+//==============================================================================
+juce::uint64 FrozenGrainCache::quantise (Grain& grain) const
+{
+    auto positionStepSize = getPositionStepSize();
+    auto samplesPerDurationStep = getSamplesPerDurationStep();
+
+    KeyFields fields;
+    fields.positionStep = juce::roundToInt (grain.position / positionStepSize) % numPositionSteps;
+    fields.durationStep = juce::jlimit (1, juce::roundToInt (maxDurationMs / durationStepMs), juce::roundToInt (grain.duration / samplesPerDurationStep));
+    fields.pitchCents = juce::jlimit (-pitchRangeCents, pitchRangeCents, juce::roundToInt (1200.0f * std::log2 (grain.pitch)));
+    fields.direction = grain.playbackDirection;
+    fields.channel = grain.stereoLinked ? 0 : grain.startChannel;
+    fields.envelopeShape = grain.envelopeShape;
+    fields.interpolation = grain.interpolation;
+    fields.stereoLinked = grain.stereoLinked ? 1 : 0;
+    fields.source = grain.source;
+
+    grain.position = (float) fields.positionStep * positionStepSize;
+    grain.duration = (float) fields.durationStep * samplesPerDurationStep;
+    grain.pitch = std::pow (2.0f, (float) fields.pitchCents / 1200.0f);
+
+    return packKey (fields);
+}
+
+float FrozenGrainCache::getPositionStepSize() const noexcept
+{
+    return (float) captures[Grain::mainInput]->getNumFrames() / (float) numPositionSteps;
+}
+
+float FrozenGrainCache::getSamplesPerDurationStep() const noexcept
+{
+    return durationStepMs / 1000.0f * (float) currentSampleRate;
+}
+
+juce::uint64 FrozenGrainCache::withGeneration (juce::uint64 key) const noexcept
+{
+    return key | ((juce::uint64) generation.load() & generationMask) << generationShift | validFlag;
+}
+
+bool FrozenGrainCache::isCurrentGeneration (juce::uint64 fullKey) const noexcept
+{
+    return ((fullKey >> generationShift) & generationMask) == ((juce::uint64) generation.load() & generationMask);
+}
+
+int FrozenGrainCache::findSlot (juce::uint64 fullKey) const
+{
+    auto count = numSlots.load();
+
+    for (int i = 0; i < count; ++i)
+        if (slots[(size_t) i].key.load() == fullKey)
+            return i;
+
+    return -1;
+}
+
+int FrozenGrainCache::acquire (juce::uint64 key)
+{
+    auto fullKey = withGeneration (key);
+    auto index = findSlot (fullKey);
+
+    if (index < 0)
+        return -1;
+
+    auto& slot = slots[(size_t) index];
+
+    // Register as a user first, then check the worker hasn't started reusing the slot
+    ++slot.users;
+
+    if (slot.key.load() != fullKey)
+    {
+        --slot.users;
+        return -1;
+    }
+
+    slot.lastUsed = ++useCounter;
+    return index;
+}
+
+void FrozenGrainCache::release (int slot)
+{
+    // After an unfreeze, the last grain off a slot lets the worker free the pool
+    if (--slots[(size_t) slot].users == 0 && ! captureFrozen.load())
+        workAvailable->post();
+}
+
+void FrozenGrainCache::request (juce::uint64 key)
+{
+    int start1, size1, start2, size2;
+    requestFifo.prepareToWrite (1, start1, size1, start2, size2);
+
+    if (size1 == 0)
+        return;
+
+    requests[(size_t) start1] = withGeneration (key);
+    requestFifo.finishedWrite (1);
+    workAvailable->post();
+}
+
+void FrozenGrainCache::setFrozen (bool shouldBeFrozen)
+{
+    // Retire the old material first, so a render in flight can't publish it
+    ++generation;
+    captureFrozen = shouldBeFrozen;
+
+    // Wake the worker so it frees the pool
+    if (! shouldBeFrozen)
+        workAvailable->post();
+}
+
+//==============================================================================
+void FrozenGrainCache::run()
+{
+    while (! threadShouldExit())
+    {
+        int start1, size1, start2, size2;
+        requestFifo.prepareToRead (1, start1, size1, start2, size2);
+
+        // Every request posts once, so this only returns when there is work or we're stopping.
+        // Unfreezing and releasing slots post too, so the pool is freed once nothing uses it.
+        if (size1 == 0)
+        {
+            releasePoolIfUnfrozen();
+            workAvailable->wait();
+            continue;
+        }
+
+        auto fullKey = requests[(size_t) start1];
+        requestFifo.finishedRead (1);
+
+        // Stale request, or already rendered by an earlier duplicate
+        if (! isCurrentGeneration (fullKey) || findSlot (fullKey) >= 0 || ! captureFrozen.load())
+            continue;
+
+        // The first request after freeze engages allocates the pool. A grain the slots are
+        // too short for, or much too long for, lays it out again once no grain plays from
+        // it; until then the request is dropped and those grains render live.
+        auto fields = unpackKey (fullKey);
+        auto length = (size_t) std::ceil ((float) fields.durationStep * getSamplesPerDurationStep());
+        auto channels = fields.stereoLinked != 0 ? 2 : 1;
+
+        if (! fitsLayout (length, channels) && ! layOutPool (length, channels))
+            continue;
+
+        // Announce the read before checking the capture is still frozen. The audio thread
+        // clears captureFrozen before it checks readingCapture, so (both being sequentially
+        // consistent) either we see the unfreeze and skip, or it sees us and holds the capture.
+        readingCapture = true;
+
+        if (captureFrozen.load() && isCurrentGeneration (fullKey))
+        {
+            auto index = claimLeastRecentlyUsedSlot();
+            if (index >= 0)
+                renderIntoSlot (slots[(size_t) index], fullKey);
+        }
+
+        readingCapture = false;
+    }
+}
+
+bool FrozenGrainCache::retireAllSlots()
+{
+    // Same handshake as claiming a slot: retract every key, then check nobody holds one
+    auto allFree = true;
+
+    for (int i = 0; i < numSlots.load(); ++i)
+    {
+        auto& slot = slots[(size_t) i];
+        slot.key = 0;
+        allFree = allFree && slot.users.load() == 0;
+    }
+
+    return allFree;
+}
+
+bool FrozenGrainCache::fitsLayout (size_t length, int numChannels) const noexcept
+{
+    return length <= slotLength && length * 2 > slotLength && numChannels <= slotChannels;
+}
+
+bool FrozenGrainCache::layOutPool (size_t length, int numChannels)
+{
+    if (! retireAllSlots())
+        return false;
+
+    KANNEN_PROFILE_SCOPE ("layOutGrainCache");
+
+    // A little headroom, so nudging the grain size up doesn't flush the cache
+    auto newSlotLength = length + length / 8;
+    auto stride = newSlotLength * (size_t) numChannels;
+    auto count = (int) juce::jmin ((size_t) maxSlots, maxCachedSamples / stride);
+
+    numSlots = 0;
+    std::vector<float> (stride * (size_t) count).swap (pool);
+    slotLength = newSlotLength;
+    slotChannels = numChannels;
+
+    for (int i = 0; i < count; ++i)
+    {
+        slots[(size_t) i].samples = pool.data() + (size_t) i * stride;
+        slots[(size_t) i].lastUsed = 0;
+    }
+
+    numSlots = count;
+    return true;
+}
+
+void FrozenGrainCache::releasePoolIfUnfrozen()
+{
+    if (pool.empty() || captureFrozen.load() || ! retireAllSlots())
+        return;
+
+    numSlots = 0;
+
+    for (auto& slot : slots)
+        slot.samples = nullptr;
+
+    std::vector<float>().swap (pool);
+    slotLength = 0;
+    slotChannels = 0;
+}
+
+int FrozenGrainCache::claimLeastRecentlyUsedSlot()
+{
+    auto now = useCounter.load();
+    auto count = numSlots.load();
+
+    for (int attempt = 0; attempt < count; ++attempt)
+    {
+        int oldest = -1;
+        juce::uint32 oldestAge = 0;
+
+        for (int i = 0; i < count; ++i)
+        {
+            auto& slot = slots[(size_t) i];
+
+            if (slot.users.load() > 0)
+                continue;
+
+            auto age = now - slot.lastUsed.load();
+            if (oldest < 0 || slot.key.load() == 0 || age > oldestAge)
+            {
+                oldest = i;
+                oldestAge = slot.key.load() == 0 ? std::numeric_limits<juce::uint32>::max() : age;
+            }
+        }
+
+        if (oldest < 0)
+            return -1;
+
+        // Retract the key, then make sure no grain picked the slot up in the meantime
+        auto& slot = slots[(size_t) oldest];
+        auto previousKey = slot.key.exchange (0);
+
+        if (slot.users.load() == 0)
+            return oldest;
+
+        slot.key = previousKey;
+    }
+
+    return -1;
+}
+
+void FrozenGrainCache::renderIntoSlot (Slot& slot, juce::uint64 fullKey)
+{
+    KANNEN_PROFILE_SCOPE ("renderCachedGrain");
+
+    auto fields = unpackKey (fullKey);
+    const auto& capture = *captures[(size_t) fields.source];
+
+    // Exactly the grain quantise() handed to the audio thread, so the cached samples match a live render
+    Grain grain;
+    grain.position = (float) fields.positionStep * getPositionStepSize();
+    grain.duration = (float) fields.durationStep * getSamplesPerDurationStep();
+    grain.pitch = std::pow (2.0f, (float) fields.pitchCents / 1200.0f);
+    grain.playbackDirection = fields.direction;
+    grain.startChannel = 0;
+    grain.stereoLinked = fields.stereoLinked != 0;
+    grain.source = fields.source;
+    grain.envelopeShape = fields.envelopeShape;
+    grain.interpolation = fields.interpolation;
+
+    auto numSamples = juce::jmin ((int) slotLength, (int) std::ceil (grain.duration));
+    std::fill (slot.samples, slot.samples + slotLength * (size_t) slotChannels, 0.0f);
+
+    // Rendered at unity, the audio thread applies the channel gains. Unlinked grains
+    // render their own channel into channel 0, linked ones keep left and right apart.
+    float* outputs[CaptureBuffer::numChannels] = { slot.samples, slot.samples + slotLength };
+    auto numOutputs = grain.stereoLinked ? 2 : 1;
+
+    GrainKernels::RenderContext context;
+    context.source = capture.getFrames() + (grain.stereoLinked ? 0 : fields.channel);
+    context.sourceLength = capture.getNumFrames();
+    context.outputs = outputs;
+    context.numSamples = numSamples;
+    context.envelopeTable = envelope.get();
+
+    auto kernel = GrainKernels::getKernel (static_cast<GrainKernels::Interpolation> (fields.interpolation),
+                                           static_cast<GrainKernels::EnvelopeShape> (fields.envelopeShape),
+                                           fields.direction, grain.stereoLinked, numOutputs);
+    kernel (grain, context);
+
+    // Only publish if the frozen material is still the one we rendered from
+    if (isCurrentGeneration (fullKey))
+        slot.key = fullKey;
+}
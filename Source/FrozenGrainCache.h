@@ -0,0 +1,133 @@
+/*
+  ==============================================================================
+
+    FrozenGrainCache.h
+    Background pre-rendering of grains from a frozen capture, so dense frozen
+    pads mix cached grains instead of interpolating and enveloping each one.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "GrainKernels.h"
+
+//==============================================================================
+/**
+    While the capture is frozen, grains with the same quantised start, size,
+    pitch, direction, channel or stereo link, envelope, interpolation and
+    source capture always sound the same. The audio thread snaps frozen grains onto that grid with quantise()
+    and tries acquire(). On a miss it renders the grain live and calls
+    request(), and the worker thread renders the variant into the least
+    recently used free slot.
+
+    Slots are published through an atomic key, and a slot is never reused
+    while a grain still holds it, so the audio thread never waits and never
+    sees a half-written grain. setFrozen() bumps a generation that is part of
+    every key, which retires the whole cache when the frozen material changes.
+
+    The slots share one pool that the worker allocates when the first request
+    arrives after freeze engages, sized for the grain length and channel count
+    of that request, and frees again once the capture is released and no grain
+    holds a slot. Until then acquire() misses and grains render live. A request
+    for a longer (or much shorter) grain than the slots hold re-lays the pool
+    out once no grain is playing from it. The slot count is whatever fits in
+    maxCachedSamples, up to maxSlots: every position, direction and channel of
+    a typical pad. At 48 kHz a pad of 100 ms grains takes all 256 slots in 5.5 MB.
+
+    The worker sleeps on a semaphore that request() posts, so it costs nothing
+    while nothing is frozen. It only reads a capture while the capture is
+    frozen; after an unfreeze the audio thread keeps the capture held until
+    isReadingCapture() is false, so a render in flight never races the writer.
+*/
+class FrozenGrainCache  : private juce::Thread
+{
+public:
+    static constexpr int numPositionSteps = 64;     // across the whole capture
+    static constexpr int maxSlots = numPositionSteps * 2 * 2;   // every position, direction and channel
+    static constexpr float durationStepMs = 5.0f;
+    static constexpr float maxDurationMs = 500.0f;
+    static constexpr size_t maxCachedSamples = 1 << 22;    // 16 MB, only while frozen
+
+    FrozenGrainCache();
+    ~FrozenGrainCache() override;
+
+    /** Stops the worker, frees the slots and starts the worker again. Both captures
+        must be the same length. Nothing is allocated for the slots until freeze engages.
+    */
+    void prepare (const CaptureBuffer& mainCapture, const CaptureBuffer& sidechainCapture,
+                  std::shared_ptr<const DspTable> envelopeTable, double sampleRate);
+    void stop();
+
+    //==============================================================================
+    // Audio thread
+
+    /** Snaps the grain onto the cache grid and returns its key. */
+    juce::uint64 quantise (Grain& grain) const;
+
+    /** Returns a slot holding the rendered grain, or -1. A slot must be given back with release(). */
+    int acquire (juce::uint64 key);
+    void release (int slot);
+
+    /** Asks the worker to render this variant. Never blocks; requests are dropped when the queue is full. */
+    void request (juce::uint64 key);
+
+    /** Call when freeze is engaged or released. Retires every cached grain. */
+    void setFrozen (bool shouldBeFrozen);
+
+    /** True while the worker may still be reading a capture. Don't write to the
+        captures until it has gone false after setFrozen (false).
+    */
+    bool isReadingCapture() const noexcept      { return readingCapture.load(); }
+
+    /** Channel 1 is only rendered for stereo-linked grains. Only valid for an acquired slot. */
+    const float* getSamples (int slot, int channel) const noexcept   { return slots[(size_t) slot].samples + (size_t) channel * slotLength; }
+
+private:
+    struct Slot
+    {
+        std::atomic<juce::uint64> key { 0 };    // 0 while empty or being rendered
+        std::atomic<int> users { 0 };
+        std::atomic<juce::uint32> lastUsed { 0 };
+        float* samples = nullptr;       // in the pool; one run of slotLength per slot channel
+    };
+
+    class WorkSemaphore;
+
+    void run() override;
+    float getPositionStepSize() const noexcept;
+    float getSamplesPerDurationStep() const noexcept;
+    juce::uint64 withGeneration (juce::uint64 key) const noexcept;
+    bool isCurrentGeneration (juce::uint64 fullKey) const noexcept;
+    int findSlot (juce::uint64 key) const;
+    bool retireAllSlots();
+    bool fitsLayout (size_t length, int numChannels) const noexcept;
+    bool layOutPool (size_t length, int numChannels);
+    void releasePoolIfUnfrozen();
+    int claimLeastRecentlyUsedSlot();
+    void renderIntoSlot (Slot& slot, juce::uint64 key);
+
+    std::array<const CaptureBuffer*, Grain::numSources> captures {};
+    std::shared_ptr<const DspTable> envelope;
+    double currentSampleRate = 44100.0;
+
+    // Written by the worker while no slot is published, read by the audio thread
+    // only through a slot it has acquired
+    std::vector<float> pool;
+    size_t slotLength = 0;
+    int slotChannels = 0;
+
+    std::array<Slot, maxSlots> slots;
+    std::atomic<int> numSlots { 0 };
+    std::atomic<juce::uint32> generation { 0 };
+    std::atomic<bool> captureFrozen { false }, readingCapture { false };
+    std::unique_ptr<WorkSemaphore> workAvailable;
+    std::atomic<juce::uint32> useCounter { 0 };
+
+    static constexpr int queueSize = 256;
+    juce::AbstractFifo requestFifo { queueSize };
+    std::array<juce::uint64, queueSize> requests {};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FrozenGrainCache)
+};
@@ -0,0 +1,58 @@
+/*
+  ==============================================================================
+
+    GrainKernels.cpp
+    Grain render kernels, specialised at compile time on interpolation,
+    envelope, playback direction, stereo link and output channel count so the
+    per-sample loops carry no branches.
+
+  ==============================================================================
+*/
+
+#include "GrainKernels.h"
+
+namespace GrainKernels
+{
+    namespace
+    {
+        // One row per interpolation/envelope pair, columns ordered by direction (forward first),
+        // then stereo link (unlinked first), then output count (mono first)
+        using KernelRow = std::array<Kernel, 8>;
+
+        template <typename InterpolationType, typename EnvelopeType>
+        constexpr KernelRow makeRow()
+        {
+            return { renderGrain<InterpolationType, EnvelopeType,  1, false, 1>,
+                     renderGrain<InterpolationType, EnvelopeType,  1, false, 2>,
+                     renderGrain<InterpolationType, EnvelopeType,  1, true,  1>,
+                     renderGrain<InterpolationType, EnvelopeType,  1, true,  2>,
+                     renderGrain<InterpolationType, EnvelopeType, -1, false, 1>,
+                     renderGrain<InterpolationType, EnvelopeType, -1, false, 2>,
+                     renderGrain<InterpolationType, EnvelopeType, -1, true,  1>,
+                     renderGrain<InterpolationType, EnvelopeType, -1, true,  2> };
+        }
+
+        // Indexed by interpolation * numEnvelopeShapes + envelope shape
+        constexpr std::array<KernelRow, 6> kernelTable
+        {
+            makeRow<LinearInterpolation, LinearDecayEnvelope>(),
+            makeRow<LinearInterpolation, RaisedCosineEnvelope>(),
+            makeRow<LinearInterpolation, FlatEnvelope>(),
+            makeRow<CubicInterpolation, LinearDecayEnvelope>(),
+            makeRow<CubicInterpolation, RaisedCosineEnvelope>(),
+            makeRow<CubicInterpolation, FlatEnvelope>()
+        };
+
+        static_assert (kernelTable.size() == (size_t) Interpolation::numInterpolations * (size_t) EnvelopeShape::numEnvelopeShapes,
+                       "Every interpolation/envelope pair needs a row");
+    }
+
+    Kernel getKernel (Interpolation interpolation, EnvelopeShape envelopeShape, int direction, bool stereoLinked, int numOutputs)
+    {
+        auto row = (size_t) interpolation * (size_t) EnvelopeShape::numEnvelopeShapes + (size_t) envelopeShape;
+        auto column = (direction > 0 ? 0 : 4) + (stereoLinked ? 2 : 0) + (numOutputs > 1 ? 1 : 0);
+
+        jassert (row < kernelTable.size());
+        return kernelTable[row][(size_t) column];
+    }
+}
@@ -0,0 +1,259 @@
+/*
+  ==============================================================================
+
+    GrainKernels.h
+    Grain render kernels, specialised at compile time on interpolation,
+    envelope, playback direction, stereo link and output channel count so the
+    per-sample loops carry no branches.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SharedDspTables.h"
+#include "CaptureBuffer.h"
+
+//==============================================================================
+struct Grain
+{
+    // Which capture the grain reads from
+    enum Source
+    {
+        mainInput = 0,
+        sidechainInput,
+        numSources
+    };
+
+    float position = 0.0f;  // where the grain starts reading; fixed for its lifetime
+    float age = 0.0f;       // whole samples rendered so far
+    float duration = 0.0f;
+    float pitch = 1.0f;
+    int playbackDirection = 1;
+    int startChannel = 0;
+    int source = mainInput;
+    bool stereoLinked = false;  // reads both capture channels of each frame instead of startChannel only
+    int envelopeShape = 1;
+    int interpolation = 0;
+    int cacheSlot = -1;     // FrozenGrainCache slot holding the pre-rendered grain, or -1
+};
+
+namespace GrainKernels
+{
+    enum class Interpolation
+    {
+        linear = 0,
+        cubic,
+        numInterpolations
+    };
+
+    enum class EnvelopeShape
+    {
+        linearDecay = 0,
+        raisedCosine,
+        flat,
+        numEnvelopeShapes
+    };
+
+    /** What a kernel reads from and adds into. */
+    struct RenderContext
+    {
+        const float* source = nullptr;      // the capture's interleaved frames
+        int sourceLength = 0;               // in frames
+        float* const* outputs = nullptr;    // already offset to the first sample to render
+        int numSamples = 0;
+        const DspTable* envelopeTable = nullptr;
+    };
+
+    /** Renders up to context.numSamples of the grain and advances its age. */
+    using Kernel = void (*) (Grain&, const RenderContext&);
+
+    /** Looks up the specialisation for a grain. direction is +1 or -1, numOutputs 1 or 2. */
+    Kernel getKernel (Interpolation interpolation, EnvelopeShape envelopeShape, int direction, bool stereoLinked, int numOutputs);
+
+    /** The read position is recomputed from the grain's start every this many samples of
+        its age, and stepped from there in between. Every sample a grain renders then only
+        depends on its age, not on how its lifetime was split into blocks and segments, so
+        a cached grain and the same grain rendered live come out the same.
+    */
+    static constexpr int positionGridSize = 64;
+
+    //==============================================================================
+    // Interpolators read one channel of interleaved frames, stride floats apart
+    struct LinearInterpolation
+    {
+        static constexpr int tapsBefore = 0, tapsAfter = 1;
+
+        template <int stride>
+        static float read (const float* data, int index, float frac) noexcept
+        {
+            auto s0 = data[index * stride], s1 = data[(index + 1) * stride];
+            return s0 + frac * (s1 - s0);
+        }
+
+        template <int stride>
+        static float readWrapped (const float* data, int length, int index, float frac) noexcept
+        {
+            auto s0 = data[index * stride], s1 = data[((index + 1) % length) * stride];
+            return s0 + frac * (s1 - s0);
+        }
+    };
+
+    struct CubicInterpolation
+    {
+        static constexpr int tapsBefore = 1, tapsAfter = 2;
+
+        static float hermite (float xm1, float x0, float x1, float x2, float frac) noexcept
+        {
+            auto c1 = 0.5f * (x1 - xm1);
+            auto c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+            auto c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            return ((c3 * frac + c2) * frac + c1) * frac + x0;
+        }
+
+        template <int stride>
+        static float read (const float* data, int index, float frac) noexcept
+        {
+            return hermite (data[(index - 1) * stride], data[index * stride],
+                            data[(index + 1) * stride], data[(index + 2) * stride], frac);
+        }
+
+        template <int stride>
+        static float readWrapped (const float* data, int length, int index, float frac) noexcept
+        {
+            return hermite (data[((index + length - 1) % length) * stride], data[index * stride],
+                            data[((index + 1) % length) * stride], data[((index + 2) % length) * stride], frac);
+        }
+    };
+
+    struct LinearDecayEnvelope
+    {
+        static float get (float proportion, const DspTable&) noexcept   { return 1.0f - proportion; }
+    };
+
+    struct RaisedCosineEnvelope
+    {
+        static float get (float proportion, const DspTable& table) noexcept   { return table.getInterpolated (proportion); }
+    };
+
+    struct FlatEnvelope
+    {
+        static float get (float, const DspTable&) noexcept   { return 1.0f; }
+    };
+
+    //==============================================================================
+    template <typename InterpolationType, typename EnvelopeType, int direction, bool stereoLinked, int numOutputs>
+    void renderGrain (Grain& grain, const RenderContext& context)
+    {
+        static_assert (direction == 1 || direction == -1, "Direction is forwards or backwards");
+        static_assert (numOutputs == 1 || numOutputs == 2, "Mono or stereo output");
+
+        constexpr int before = InterpolationType::tapsBefore;
+        constexpr int after = InterpolationType::tapsAfter;
+        constexpr int stride = CaptureBuffer::numChannels;
+        constexpr int numSourceChannels = stereoLinked ? CaptureBuffer::numChannels : 1;
+
+        // A linked grain reads both channels of each frame, which sit next to each other
+        const auto* source = stereoLinked ? context.source : context.source + grain.startChannel;
+        const auto length = context.sourceLength;
+        const auto& envelopeTable = *context.envelopeTable;
+
+        const float step = grain.pitch * (float) direction;
+        const float inverseDuration = 1.0f / grain.duration;
+
+        // Linked grains keep the capture's stereo image (folded to mono for one output).
+        // Otherwise full level on the grain's own channel, half on the other; a single
+        // output is the grain's own channel whichever one it started on.
+        float gains[numSourceChannels][numOutputs];
+        for (int sourceChannel = 0; sourceChannel < numSourceChannels; ++sourceChannel)
+        {
+            for (int channel = 0; channel < numOutputs; ++channel)
+            {
+                if (stereoLinked)
+                    gains[sourceChannel][channel] = numOutputs == 1 ? 0.5f : (channel == sourceChannel ? 1.0f : 0.0f);
+                else
+                    gains[sourceChannel][channel] = numOutputs == 1 || channel == grain.startChannel ? 1.0f : 0.5f;
+            }
+        }
+
+        auto mix = [&gains, &context] (const float (&frame)[numSourceChannels], int outputIndex) noexcept
+        {
+            for (int channel = 0; channel < numOutputs; ++channel)
+            {
+                auto sum = 0.0f;
+                for (int sourceChannel = 0; sourceChannel < numSourceChannels; ++sourceChannel)
+                    sum += frame[sourceChannel] * gains[sourceChannel][channel];
+
+                context.outputs[channel][outputIndex] += sum;
+            }
+        };
+
+        auto age = (int) grain.age;
+        auto remaining = juce::jmin (context.numSamples, (int) std::ceil (grain.duration - grain.age));
+
+        for (int i = 0; i < remaining;)
+        {
+            // Position at the start of this grid cell, from the grain's start in double precision
+            auto cellStart = age - age % positionGridSize;
+            auto cellPosition = std::fmod ((double) grain.position + (double) cellStart * (double) step, (double) length);
+            const auto basePosition = (float) (cellPosition < 0.0 ? cellPosition + (double) length : cellPosition);
+
+            auto offset = age - cellStart;
+            auto count = juce::jmin (remaining - i, positionGridSize - offset);
+
+            // Every tap of the cell inside the buffer: no wrapping needed
+            auto firstPosition = basePosition + (float) offset * step;
+            auto lastPosition = basePosition + (float) (offset + count - 1) * step;
+
+            if (juce::jmin (firstPosition, lastPosition) >= (float) before
+                 && juce::jmax (firstPosition, lastPosition) < (float) (length - after))
+            {
+                // Position and age are computed from the cell start rather than
+                // accumulated, so iterations are independent and can be vectorised
+                for (int n = 0; n < count; ++n)
+                {
+                    auto samplePosition = basePosition + (float) (offset + n) * step;
+                    auto index = (int) samplePosition;
+                    auto frac = samplePosition - (float) index;
+                    auto envelope = EnvelopeType::get ((float) (age + n) * inverseDuration, envelopeTable);
+
+                    float frame[numSourceChannels];
+                    for (int sourceChannel = 0; sourceChannel < numSourceChannels; ++sourceChannel)
+                        frame[sourceChannel] = InterpolationType::template read<stride> (source + sourceChannel, index, frac) * envelope;
+
+                    mix (frame, i + n);
+                }
+            }
+            else
+            {
+                // Near the ends of the buffer: the same positions, with wrapped taps
+                for (int n = 0; n < count; ++n)
+                {
+                    auto samplePosition = basePosition + (float) (offset + n) * step;
+
+                    if (samplePosition >= (float) length)
+                        samplePosition -= (float) length;
+                    else if (samplePosition < 0.0f)
+                        samplePosition += (float) length;
+
+                    auto index = (int) samplePosition;
+                    auto frac = samplePosition - (float) index;
+                    index %= length;
+                    auto envelope = EnvelopeType::get ((float) (age + n) * inverseDuration, envelopeTable);
+
+                    float frame[numSourceChannels];
+                    for (int sourceChannel = 0; sourceChannel < numSourceChannels; ++sourceChannel)
+                        frame[sourceChannel] = InterpolationType::template readWrapped<stride> (source + sourceChannel, length, index, frac) * envelope;
+
+                    mix (frame, i + n);
+                }
+            }
+
+            age += count;
+            i += count;
+        }
+
+        grain.age = (float) age;
+    }
+}
@@ -0,0 +1,120 @@
+/*
+  ==============================================================================
+
+    OscControlReceiver.cpp
+    Receives parameter changes over OSC on the receiver's own thread and hands
+    them to the audio thread through a wait-free single-producer queue.
+
+  ==============================================================================
+*/
+
+#include "OscControlReceiver.h"
+#include "Profiler.h"
+
+//==============================================================================
+OscControlReceiver::OscControlReceiver (const juce::StringArray& parameterIDsToUse)
+    : parameterIDs (parameterIDsToUse)
+{
+    receiver.addListener (this);
+}
+
+OscControlReceiver::~OscControlReceiver()
+{
+    disconnect();
+    receiver.removeListener (this);
+}
+
+bool OscControlReceiver::connect (const Settings& settings)
+{
+    disconnect();
+
+    // The receiver thread is stopped, so the addresses can change under it
+    auto prefix = settings.instanceName.trim().isEmpty() ? juce::String ("/kannen/")
+                                                          : "/kannen/" + settings.instanceName.trim() + "/";
+    addresses.clearQuick();
+
+    for (auto& id : parameterIDs)
+        addresses.add (prefix + id);
+
+    socket = std::make_unique<juce::DatagramSocket>();
+
+    // Failing to bind (e.g. another instance has the port) leaves this one without OSC control
+    if (! socket->bindToPort (settings.port, settings.localOnly ? "127.0.0.1" : juce::String()))
+    {
+        socket.reset();
+        return false;
+    }
+
+    connected = receiver.connectToSocket (*socket);
+
+    if (! connected)
+        socket.reset();
+
+    return connected;
+}
+
+void OscControlReceiver::disconnect()
+{
+    if (connected)
+        receiver.disconnect();
+
+    socket.reset();
+    connected = false;
+}
+
+//==============================================================================
+void OscControlReceiver::oscMessageReceived (const juce::OSCMessage& message)
+{
+    KANNEN_PROFILE_SCOPE ("oscMessage");
+
+    if (message.isEmpty())
+        return;
+
+    auto parameterIndex = addresses.indexOf (message.getAddressPattern().toString());
+    if (parameterIndex < 0)
+        return;
+
+    auto& argument = message[0];
+
+    if (argument.isFloat32())
+        pushChange (parameterIndex, argument.getFloat32());
+    else if (argument.isInt32())
+        pushChange (parameterIndex, (float) argument.getInt32());
+}
+
+void OscControlReceiver::oscBundleReceived (const juce::OSCBundle& bundle)
+{
+    for (auto& element : bundle)
+    {
+        if (element.isMessage())
+            oscMessageReceived (element.getMessage());
+        else if (element.isBundle())
+            oscBundleReceived (element.getBundle());
+    }
+}
+
+void OscControlReceiver::pushChange (int parameterIndex, float value)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (1, start1, size1, start2, size2);
+
+    // Queue full: the audio thread has stalled, drop rather than block
+    if (size1 == 0)
+        return;
+
+    queue[(size_t) start1] = { parameterIndex, value, juce::Time::getMillisecondCounterHiRes() };
+    fifo.finishedWrite (1);
+}
+
+bool OscControlReceiver::popChangeBefore (double timeLimitMs, ParameterChange& change)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (1, start1, size1, start2, size2);
+
+    if (size1 == 0 || queue[(size_t) start1].timeMs >= timeLimitMs)
+        return false;
+
+    change = queue[(size_t) start1];
+    fifo.finishedRead (1);
+    return true;
+}
@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    OscControlReceiver.h
+    Receives parameter changes over OSC on the receiver's own thread and hands
+    them to the audio thread through a wait-free single-producer queue.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Listens for messages of the form "/kannen/<parameterID> <value>", or
+    "/kannen/<instance>/<parameterID> <value>" when an instance name is set, and
+    queues them with their arrival time. Values are in the parameter's own units
+    (e.g. Hz for filterCutoff). Decoding happens on the OSC thread, so the
+    message thread and the AudioProcessorValueTreeState listeners are never
+    involved.
+
+    The OSC thread is the only producer and the audio thread the only
+    consumer; both sides of the queue are wait-free.
+
+    Nothing listens until connect() is called. Every instance needs its own
+    port, and by default only accepts messages from the local machine.
+*/
+class OscControlReceiver  : private juce::OSCReceiver::Listener<juce::OSCReceiver::RealtimeCallback>
+{
+public:
+    static constexpr int defaultPort = 9001;
+
+    struct Settings
+    {
+        bool enabled = false;
+        int port = defaultPort;
+        juce::String instanceName;  // empty: "/kannen/<parameterID>"
+        bool localOnly = true;      // bind to 127.0.0.1 instead of every interface
+    };
+
+    struct ParameterChange
+    {
+        int parameterIndex = 0;
+        float value = 0.0f;
+        double timeMs = 0.0;    // juce::Time::getMillisecondCounterHiRes() at arrival
+    };
+
+    /** The index of each ID in parameterIDs is what ParameterChange::parameterIndex refers to. */
+    explicit OscControlReceiver (const juce::StringArray& parameterIDsToUse);
+    ~OscControlReceiver() override;
+
+    /** Message thread. Binds the port and starts listening at the settings' addresses. */
+    bool connect (const Settings& settings);
+    void disconnect();
+    bool isConnected() const noexcept   { return connected; }
+
+    /** Audio thread only. Pops the oldest change if it arrived before timeLimitMs. */
+    bool popChangeBefore (double timeLimitMs, ParameterChange& change);
+
+private:
+    void oscMessageReceived (const juce::OSCMessage& message) override;
+    void oscBundleReceived (const juce::OSCBundle& bundle) override;
+    void pushChange (int parameterIndex, float value);
+
+    static constexpr int queueSize = 1024;
+
+    juce::OSCReceiver receiver { "Kannen OSC Control" };
+    std::unique_ptr<juce::DatagramSocket> socket;
+    juce::StringArray parameterIDs, addresses;   // addresses only change while disconnected
+    bool connected = false;
+
+    juce::AbstractFifo fifo { queueSize };
+    std::array<ParameterChange, queueSize> queue;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OscControlReceiver)
+};
@@ -70,6 +70,44 @@ KannenGranularEngineAudioProcessorEditor::KannenGranularEngineAudioProcessorEdit
     freezeLabel.setText("Freeze Mode", juce::dontSendNotification);
     freezeLabel.setJustificationType(juce::Justification::centred);
 
+    // OSC
+    auto oscSettings = audioProcessor.getOscSettings();
+
+    addAndMakeVisible(oscEnabledButton);
+    oscEnabledButton.setButtonText("OSC Control");
+    oscEnabledButton.setToggleState(oscSettings.enabled, juce::dontSendNotification);
+    oscEnabledButton.onClick = [this] { applyOscSettings(); };
+
+    addAndMakeVisible(oscPortEditor);
+    oscPortEditor.setInputRestrictions(5, "0123456789");
+    oscPortEditor.setText(juce::String(oscSettings.port), false);
+    oscPortEditor.onReturnKey = oscPortEditor.onFocusLost = [this] { applyOscSettings(); };
+    addAndMakeVisible(oscPortLabel);
+    oscPortLabel.setText("Port", juce::dontSendNotification);
+
+    addAndMakeVisible(oscInstanceEditor);
+    oscInstanceEditor.setInputRestrictions(32, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_");
+    oscInstanceEditor.setTextToShowWhenEmpty("(none)", juce::Colours::grey);
+    oscInstanceEditor.setText(oscSettings.instanceName, false);
+    oscInstanceEditor.onReturnKey = oscInstanceEditor.onFocusLost = [this] { applyOscSettings(); };
+    addAndMakeVisible(oscInstanceLabel);
+    oscInstanceLabel.setText("Instance", juce::dontSendNotification);
+
+    addAndMakeVisible(oscStatusLabel);
+    updateOscStatus();
+
+   #if KANNEN_ENABLE_PROFILING
+    // Profiling builds: dump the recorded zones to the desktop, open in ui.perfetto.dev or chrome://tracing
+    addAndMakeVisible(dumpTraceButton);
+    dumpTraceButton.setButtonText("Dump Trace");
+    dumpTraceButton.onClick = [this]
+    {
+        auto file = juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
+                        .getNonexistentChildFile("kannen-trace-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S"), ".json");
+        audioProcessor.writeProfileTrace(file);
+    };
+   #endif
+
     setSize(600, 400);
 }
 
@@ -77,6 +115,30 @@ KannenGranularEngineAudioProcessorEditor::~KannenGranularEngineAudioProcessorEdi
 {
 }
 
+void KannenGranularEngineAudioProcessorEditor::applyOscSettings()
+{
+    auto settings = audioProcessor.getOscSettings();
+    settings.enabled = oscEnabledButton.getToggleState();
+    settings.port = oscPortEditor.getText().getIntValue();
+    settings.instanceName = oscInstanceEditor.getText();
+
+    audioProcessor.setOscSettings(settings);
+    updateOscStatus();
+}
+
+void KannenGranularEngineAudioProcessorEditor::updateOscStatus()
+{
+    auto settings = audioProcessor.getOscSettings();
+    auto prefix = settings.instanceName.isEmpty() ? juce::String("/kannen/") : "/kannen/" + settings.instanceName + "/";
+
+    if (! settings.enabled)
+        oscStatusLabel.setText("Off", juce::dontSendNotification);
+    else if (audioProcessor.isOscConnected())
+        oscStatusLabel.setText(prefix + "<param> on port " + juce::String(settings.port), juce::dontSendNotification);
+    else
+        oscStatusLabel.setText("Not listening on port " + juce::String(settings.port), juce::dontSendNotification);
+}
+
 //==============================================================================
 void KannenGranularEngineAudioProcessorEditor::paint (juce::Graphics& g)
 {
@@ -118,4 +180,17 @@ void KannenGranularEngineAudioProcessorEditor::resized()
 
     freezeButton.setBounds(2 * margin + controlWidth, 200, controlWidth, 40);
     freezeLabel.setBounds(2 * margin + controlWidth, 250, controlWidth, 20);
+
+    // OSC (right of the freeze button)
+    int oscLeft = 3 * margin + 2 * controlWidth;
+    oscEnabledButton.setBounds(oscLeft, 180, 2 * controlWidth, 24);
+    oscPortLabel.setBounds(oscLeft, 210, 70, 24);
+    oscPortEditor.setBounds(oscLeft + 70, 210, 80, 24);
+    oscInstanceLabel.setBounds(oscLeft, 240, 70, 24);
+    oscInstanceEditor.setBounds(oscLeft + 70, 240, 150, 24);
+    oscStatusLabel.setBounds(oscLeft, 270, 2 * controlWidth + margin, 24);
+
+   #if KANNEN_ENABLE_PROFILING
+    dumpTraceButton.setBounds(getWidth() - margin - controlWidth, getHeight() - margin - 30, controlWidth, 30);
+   #endif
 }
@@ -30,6 +30,18 @@ private:
     juce::ToggleButton freezeButton;
     juce::Label grainDensityLabel, grainSizeLabel, pitchShiftLabel, feedbackLabel, filterCutoffLabel, freezeLabel;
 
+    // OSC remote control, off by default
+    juce::ToggleButton oscEnabledButton;
+    juce::TextEditor oscPortEditor, oscInstanceEditor;
+    juce::Label oscPortLabel, oscInstanceLabel, oscStatusLabel;
+
+    void applyOscSettings();
+    void updateOscStatus();
+
+   #if KANNEN_ENABLE_PROFILING
+    juce::TextButton dumpTraceButton;
+   #endif
+
 
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
@@ -9,6 +9,22 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
+namespace
+{
+    // In ControlId order; also the OSC address of each control ("/kannen/[<instance>/]<id>")
+    const juce::StringArray controlParameterIDs { "grainDensity", "grainSize", "pitchShift", "feedback",
+                                                  "freeze", "filterCutoff", "grainPlacement", "placementCentroid",
+                                                  "envelopeShape", "interpolation", "stereoLink",
+                                                  "sidechainMix", "densityMultiplier" };
+
+    // OSC settings are saved with the plugin state, next to the parameters
+    const juce::Identifier oscStateType { "OSC" };
+    const juce::Identifier oscEnabledID { "enabled" };
+    const juce::Identifier oscPortID { "port" };
+    const juce::Identifier oscInstanceID { "instance" };
+    const juce::Identifier oscLocalOnlyID { "localOnly" };
+}
+
 //==============================================================================
 KannenGranularEngineAudioProcessor::KannenGranularEngineAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -16,6 +32,7 @@ KannenGranularEngineAudioProcessor::KannenGranularEngineAudioProcessor()
                      #if ! JucePlugin_IsMidiEffect
                       #if ! JucePlugin_IsSynth
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                       .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
@@ -26,8 +43,16 @@ KannenGranularEngineAudioProcessor::KannenGranularEngineAudioProcessor()
                                std::make_unique<juce::AudioParameterFloat>("pitchShift", "Pitch Shift", -12.0f, 12.0f, 0.0f),
                                std::make_unique<juce::AudioParameterFloat>("feedback", "Feedback", 0.0f, 0.95f, 0.5f),
                                std::make_unique<juce::AudioParameterBool>("freeze", "Freeze", false),
-                               std::make_unique<juce::AudioParameterFloat>("filterCutoff", "Filter Cutoff", 100.0f, 10000.0f, 5000.0f)
-                           })
+                               std::make_unique<juce::AudioParameterFloat>("filterCutoff", "Filter Cutoff", 100.0f, 10000.0f, 5000.0f),
+                               std::make_unique<juce::AudioParameterChoice>("grainPlacement", "Grain Placement", juce::StringArray { "Random", "Onsets", "Loud", "Centroid" }, 0),
+                               std::make_unique<juce::AudioParameterFloat>("placementCentroid", "Placement Centroid", 100.0f, 10000.0f, 1000.0f),
+                               std::make_unique<juce::AudioParameterChoice>("envelopeShape", "Envelope Shape", juce::StringArray { "Linear Decay", "Raised Cosine", "Flat" }, 1),
+                               std::make_unique<juce::AudioParameterChoice>("interpolation", "Interpolation", juce::StringArray { "Linear", "Cubic" }, 0),
+                               std::make_unique<juce::AudioParameterBool>("stereoLink", "Stereo Link", false),
+                               std::make_unique<juce::AudioParameterFloat>("sidechainMix", "Sidechain Mix", 0.0f, 1.0f, 0.0f),
+                               std::make_unique<juce::AudioParameterFloat>("densityMultiplier", "Density Multiplier", juce::NormalisableRange<float>(1.0f, 200.0f, 0.0f, 0.3f), 1.0f)
+                           }),
+                       oscReceiver(controlParameterIDs)
 #endif
 {
     grainDensityParam = parameters.getRawParameterValue("grainDensity");
@@ -36,6 +61,24 @@ KannenGranularEngineAudioProcessor::KannenGranularEngineAudioProcessor()
     feedbackParam = parameters.getRawParameterValue("feedback");
     freezeParam = parameters.getRawParameterValue("freeze");
     filterCutoffParam = parameters.getRawParameterValue("filterCutoff");
+    grainPlacementParam = parameters.getRawParameterValue("grainPlacement");
+    placementCentroidParam = parameters.getRawParameterValue("placementCentroid");
+    envelopeShapeParam = parameters.getRawParameterValue("envelopeShape");
+    interpolationParam = parameters.getRawParameterValue("interpolation");
+    stereoLinkParam = parameters.getRawParameterValue("stereoLink");
+    sidechainMixParam = parameters.getRawParameterValue("sidechainMix");
+    densityMultiplierParam = parameters.getRawParameterValue("densityMultiplier");
+
+    envelopeTable = sharedTables->getTable(SharedDspTables::TableType::grainEnvelope, envelopeTableSize);
+
+    for (size_t i = 0; i < controlParams.size(); ++i)
+    {
+        controlParams[i] = parameters.getRawParameterValue(controlParameterIDs[(int) i]);
+        controlRanges[i] = parameters.getParameterRange(controlParameterIDs[(int) i]);
+        controlValues[i] = controlParams[i]->load();
+    }
+
+    publishRenderedControls();
 }
 
 KannenGranularEngineAudioProcessor::~KannenGranularEngineAudioProcessor()
@@ -77,7 +120,25 @@ bool KannenGranularEngineAudioProcessor::isMidiEffect() const
 
 double KannenGranularEngineAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    // The values the audio thread last rendered with, which include OSC overrides the
+    // host parameters don't know about
+
+    // A frozen capture keeps producing grains for as long as it stays frozen
+    if (renderedFreeze.load())
+        return std::numeric_limits<double>::infinity();
+
+    // Once the input stops, each pass round the capture scales it by the feedback,
+    // so count the passes until a full-scale signal drops below the silence threshold
+    double captureSeconds = 2.0; // capture length
+    double feedback = renderedFeedback.load();
+    double passes = feedback > 0.0 ? std::ceil(std::log((double) silenceThreshold) / std::log(feedback)) : 0.0;
+
+    // Then the last grains play out, and the spectral engine flushes its overlap-add
+    double grainSeconds = renderedGrainSize.load() / 1000.0;
+    double sampleRate = getSampleRate() > 0.0 ? getSampleRate() : 44100.0;
+    double spectralSeconds = SpectralGranulator::fftSize / sampleRate;
+
+    return captureSeconds * (1.0 + passes) + grainSeconds + spectralSeconds;
 }
 
 int KannenGranularEngineAudioProcessor::getNumPrograms()
@@ -108,8 +169,44 @@ void KannenGranularEngineAudioProcessor::changeProgramName (int index, const juc
 void KannenGranularEngineAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     currentSampleRate = sampleRate;
-    delayLine.setSize(2, (int)(sampleRate * 2)); // 2 seconds max
-    grainFilter.setCoefficients(juce::IIRCoefficients::makeLowPass(sampleRate, *filterCutoffParam));
+    for (auto& capture : captures)
+        capture.setSize((int)(sampleRate * 2)); // 2 seconds max
+    delayLineWritePosition = 0;
+    previousPassPeak = currentPassPeak = 0.0f;
+    idle = false;
+
+    for (auto& index : captureIndexes)
+        index.prepare(sampleRate, captures[Grain::mainInput].getNumFrames());
+
+    // A sidechain the host hasn't connected is never written or read
+    sidechainEnabled = getBusCount(true) > 1 && getChannelCountOfBus(true, 1) > 0;
+
+    for (auto& filter : grainFilters)
+    {
+        filter.setCoefficients(juce::IIRCoefficients::makeLowPass(sampleRate, *filterCutoffParam));
+        filter.reset();
+    }
+
+    lastFilterCutoff = *filterCutoffParam;
+
+    // Start every run from the same state so renders are reproducible
+    activeGrains.clearQuick();
+    activeGrains.ensureStorageAllocated(maxActiveGrains);
+    grainRandom.setSeed(grainRandomSeed);
+    grainsToSchedule = 0.0f;
+    numGrainsScheduled = 0;
+    frozenGrainCache.prepare(captures[Grain::mainInput], captures[Grain::sidechainInput], envelopeTable, sampleRate);
+    spectralEngineActive = false;
+
+    spectralGranulator.prepare(sampleRate, getTotalNumOutputChannels());
+    spectralBuffer.setSize(getTotalNumOutputChannels(), juce::jmax(1, samplesPerBlock)); // processBlock renders in chunks of this
+    spectralGain.reset(sampleRate, 0.05); // 50 ms crossfade between engines
+    spectralGain.setCurrentAndTargetValue(spectralEngineActive ? 1.0f : 0.0f);
+
+    // OSC is opt-in; only listen once the user has enabled it for this instance
+    prepared = true;
+    applyOscSettings();
+    previousBlockStartMs = juce::Time::getMillisecondCounterHiRes();
 
     pitchLFO.frequency = 0.5f; // Example LFO rates
     panLFO.frequency = 0.3f;
@@ -117,38 +214,183 @@ void KannenGranularEngineAudioProcessor::prepareToPlay (double sampleRate, int s
 
 void KannenGranularEngineAudioProcessor::releaseResources()
 {
-    delayLine.clear();
+    prepared = false;
+    oscReceiver.disconnect();
+    frozenGrainCache.stop();
+    for (auto& capture : captures)
+        capture.clear();
 }
 
-void KannenGranularEngineAudioProcessor::scheduleGrains()
+void KannenGranularEngineAudioProcessor::scheduleGrains(int numSamples)
 {
-   float density = *grainDensityParam;
-   float blockTime = getBlockSize() / currentSampleRate;
-   int grainsToAdd = static_cast<int>(density * blockTime + 0.5f);
+   KANNEN_PROFILE_SCOPE("scheduleGrains");
+
+   // Grains would only read silence
+   if (isCaptureSilent())
+   {
+       grainsToSchedule = 0.0f;
+       return;
+   }
+
+   // Carry the fractional part so short segments still add up to the right density
+   grainsToSchedule += getTimeDomainGrainDensity() * static_cast<float>(numSamples / currentSampleRate);
+   int grainsToAdd = static_cast<int>(grainsToSchedule);
+   grainsToSchedule -= static_cast<float>(grainsToAdd);
 
    for (int i = 0; i < grainsToAdd; ++i)
    {
-       Grain grain;
-       grain.startChannel = juce::Random::getSystemRandom().nextInt(getTotalNumInputChannels());
-       grain.position = juce::Random::getSystemRandom().nextFloat() * delayLine.getNumSamples();
-       grain.duration = (*grainSizeParam / 1000.0f) * currentSampleRate;
-       grain.pitch = pow(2.0f, *pitchShiftParam / 12.0f); // Semitones to ratio
-       grain.playbackDirection = juce::Random::getSystemRandom().nextBool() ? 1 : -1;
-       activeGrains.add(grain);
+       if (! startGrain(0.0f))
+       {
+           grainsToSchedule = 0.0f;
+           break;
+       }
+   }
+}
+
+void KannenGranularEngineAudioProcessor::prefillGrains()
+{
+   // Coming back from the spectral engine, start with the population the scheduler
+   // would have built up by now, so the grain bus fades in at its steady level
+   // instead of growing from silence over a grain length
+   if (isCaptureSilent())
+       return;
+
+   auto duration = (getControl(grainSizeControl) / 1000.0f) * currentSampleRate;
+   auto population = juce::roundToInt(getTimeDomainGrainDensity() * (getControl(grainSizeControl) / 1000.0f));
+
+   for (int i = 0; i < population; ++i)
+       if (! startGrain(std::floor(grainRandom.nextFloat() * duration)))
+           break;
+}
+
+bool KannenGranularEngineAudioProcessor::startGrain(float age)
+{
+   // The crossover keeps steady-state overlap well below this, but a big jump in
+   // density or size can get here before the block ends. The pool is fixed so the
+   // audio thread never allocates; the extra grains are dropped.
+   if (activeGrains.size() >= maxActiveGrains)
+       return false;
+
+   auto placement = static_cast<CaptureIndex::Placement>(static_cast<int>(getControl(grainPlacementControl)));
+   float sidechainMix = getControl(sidechainMixControl);
+
+   Grain grain;
+
+   // Each grain reads the sidechain instead of the main input with probability sidechainMix
+   if (sidechainEnabled && sidechainMix > 0.0f && grainRandom.nextFloat() < sidechainMix)
+       grain.source = Grain::sidechainInput;
+
+   grain.startChannel = grainRandom.nextInt(juce::jmax(1, getChannelCountOfBus(true, grain.source)));
+   grain.position = grainRandom.nextFloat() * captures[(size_t) grain.source].getNumFrames();
+
+   // Fall back to the uniform position while the index has nothing that matches
+   int indexedPosition = captureIndexes[(size_t) grain.source].findPosition(placement, getControl(placementCentroidControl), grainRandom);
+   if (indexedPosition >= 0)
+       grain.position = static_cast<float>(indexedPosition);
+
+   grain.duration = (getControl(grainSizeControl) / 1000.0f) * currentSampleRate;
+   grain.pitch = pow(2.0f, getControl(pitchShiftControl) / 12.0f); // Semitones to ratio
+   grain.playbackDirection = grainRandom.nextBool() ? 1 : -1;
+   grain.stereoLinked = getControl(stereoLinkControl) >= 0.5f;
+   grain.envelopeShape = static_cast<int>(getControl(envelopeShapeControl));
+   grain.interpolation = static_cast<int>(getControl(interpolationControl));
+   grain.age = age;
+
+   // Frozen material is static, so snap onto the cache grid and reuse a pre-rendered grain if there is one.
+   // Offline renders skip the cache: whether a grain is cached depends on the worker's timing, and
+   // cached grains only match live ones to within rounding, so this keeps bounces bit-for-bit reproducible.
+   if (freezeMode)
+   {
+       auto key = frozenGrainCache.quantise(grain);
+
+       if (! isNonRealtime())
+       {
+           grain.cacheSlot = frozenGrainCache.acquire(key);
+
+           if (grain.cacheSlot < 0)
+               frozenGrainCache.request(key);
+       }
    }
+
+   activeGrains.add(grain);
+   ++numGrainsScheduled;
+
+   return true;
+}
+
+bool KannenGranularEngineAudioProcessor::isCaptureSilent() const
+{
+    return juce::jmax(previousPassPeak, currentPassPeak) < silenceThreshold;
+}
+
+float KannenGranularEngineAudioProcessor::getGrainDensity() const
+{
+    return getControl(grainDensityControl) * getControl(densityMultiplierControl);
+}
+
+float KannenGranularEngineAudioProcessor::getTimeDomainGrainDensity() const
+{
+    // Past the crossover the spectral engine renders the cloud. Grains still scheduled
+    // while it fades in are held to the crossover overlap, so a jump to a huge density
+    // doesn't fill the pool with grains that are about to be faded out.
+    auto grainSeconds = getControl(grainSizeControl) / 1000.0f;
+    return juce::jmin(getGrainDensity(), spectralCrossoverOverlap / grainSeconds);
+}
+
+float KannenGranularEngineAudioProcessor::getExpectedGrainOverlap() const
+{
+    // Grains alive at any moment: rate times lifetime
+    return getGrainDensity() * (getControl(grainSizeControl) / 1000.0f);
 }
 
-float KannenGranularEngineAudioProcessor::generateEnvelope(const Grain& grain, int envelopeType)
+void KannenGranularEngineAudioProcessor::updateControlsFromHost()
 {
-    float position = grain.position / grain.duration;
-    switch (envelopeType)
+    hostRampActive = false;
+
+    for (size_t i = 0; i < controlValues.size(); ++i)
     {
-    case 0: return std::max(0.0f, 1.0f - position); // Linear Decay
-    case 1: return 0.5f * (1.0f + std::cos(juce::MathConstants<float>::pi * position)); // Raised Cosine
-    default: return 1.0f; // Flat
+        float hostValue = controlParams[i]->load();
+
+        // Moving the parameter in the host takes control back from OSC
+        if (controlOverridden[i] && hostValue != hostValuesAtOverride[i])
+            controlOverridden[i] = false;
+
+        if (controlOverridden[i])
+            continue;
+
+        // The host only gives us one value per block, so continuous controls ramp
+        // to it from where they ended the last block. Steps (choices, toggles) jump.
+        hostRampStart[i] = controlValues[i];
+        hostRampEnd[i] = hostValue;
+
+        if (controlRanges[i].interval > 0.0f || hostRampStart[i] == hostRampEnd[i])
+            controlValues[i] = hostValue;
+        else
+            hostRampActive = true;
     }
 }
 
+void KannenGranularEngineAudioProcessor::advanceHostRamps(float proportion)
+{
+    if (! hostRampActive)
+        return;
+
+    for (size_t i = 0; i < controlValues.size(); ++i)
+        if (! controlOverridden[i] && hostRampStart[i] != hostRampEnd[i])
+            controlValues[i] = hostRampStart[i] + proportion * (hostRampEnd[i] - hostRampStart[i]);
+}
+
+void KannenGranularEngineAudioProcessor::applyControlChange(int controlIndex, float value)
+{
+    if (! juce::isPositiveAndBelow(controlIndex, (int) numControls))
+        return;
+
+    auto i = (size_t) controlIndex;
+    controlValues[i] = controlRanges[i].snapToLegalValue(value);
+    hostValuesAtOverride[i] = controlParams[i]->load();
+    controlOverridden[i] = true;
+}
+
 #ifndef JucePlugin_PreferredChannelConfigurations
 bool KannenGranularEngineAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
@@ -168,6 +410,16 @@ bool KannenGranularEngineAudioProcessor::isBusesLayoutSupported (const BusesLayo
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
         return false;
+
+    // The sidechain can be off, mono or stereo
+    if (layouts.inputBuses.size() > 1)
+    {
+        auto sidechain = layouts.getChannelSet(true, 1);
+        if (! sidechain.isDisabled()
+         && sidechain != juce::AudioChannelSet::mono()
+         && sidechain != juce::AudioChannelSet::stereo())
+            return false;
+    }
    #endif
 
     return true;
@@ -177,89 +429,353 @@ bool KannenGranularEngineAudioProcessor::isBusesLayoutSupported (const BusesLayo
 
 void KannenGranularEngineAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    KANNEN_PROFILE_SCOPE("processBlock");
+    KANNEN_REALTIME_SECTION
     juce::ScopedNoDenormals noDenormals;
-    auto totalNumInputChannels = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
     auto numSamples = buffer.getNumSamples();
 
+    updateControlsFromHost();
+
+    // Nothing coming in, nothing left in the capture and no grains still playing:
+    // output silence without touching the capture or the grain engines
+    bool inputSilent = true;
+    for (int channel = 0; channel < getTotalNumInputChannels(); ++channel)
+        inputSilent = inputSilent && buffer.getMagnitude(channel, 0, numSamples) < silenceThreshold;
+
+    if (inputSilent && isCaptureSilent() && activeGrains.isEmpty())
+    {
+        if (! idle)
+        {
+            for (auto& filter : grainFilters)
+                filter.reset();
+
+            spectralGranulator.reset();
+            idle = true;
+        }
+
+        // Keep host and OSC changes current so waking up uses the latest values
+        advanceHostRamps(1.0f);
+
+        OscControlReceiver::ParameterChange change;
+        auto blockStartMs = juce::Time::getMillisecondCounterHiRes();
+        while (oscReceiver.popChangeBefore(blockStartMs, change))
+            applyControlChange(change.parameterIndex, change.value);
+
+        previousBlockStartMs = blockStartMs;
+        publishRenderedControls();
+        buffer.clear();
+        return;
+    }
+
+    idle = false;
+
+    // OSC changes that arrived during the previous block are replayed at the
+    // same offsets in this one, which keeps their spacing at the cost of one block of latency
+    auto blockStartMs = juce::Time::getMillisecondCounterHiRes();
+    auto samplesPerMs = currentSampleRate / 1000.0;
+    auto getChangeOffset = [&](const OscControlReceiver::ParameterChange& change)
+    {
+        return juce::jlimit(0, numSamples - 1, (int) ((change.timeMs - previousBlockStartMs) * samplesPerMs));
+    };
+
+    OscControlReceiver::ParameterChange pendingChange;
+    bool hasPendingChange = oscReceiver.popChangeBefore(blockStartMs, pendingChange);
+
+    // Split the block at control changes, and on a fixed grid while host automation ramps.
+    // Changes closer together than minSegmentLength are applied together at the start of
+    // a segment, so dense automation never drops the renderer to a handful of samples.
+    for (int segmentStart = 0; segmentStart < numSamples;)
+    {
+        while (hasPendingChange && getChangeOffset(pendingChange) <= segmentStart)
+        {
+            applyControlChange(pendingChange.parameterIndex, pendingChange.value);
+            hasPendingChange = oscReceiver.popChangeBefore(blockStartMs, pendingChange);
+        }
+
+        int nextChange = numSamples;
+        if (hasPendingChange)
+            nextChange = juce::jmin(nextChange, getChangeOffset(pendingChange));
+        if (hostRampActive)
+            nextChange = juce::jmin(nextChange, segmentStart + minSegmentLength);
+
+        int segmentEnd = juce::jmin(numSamples, juce::jmax(nextChange, segmentStart + minSegmentLength));
+
+        // Ramped controls reach the host's value at the end of the block
+        advanceHostRamps((float) segmentEnd / (float) numSamples);
+
+        renderSegment(buffer, segmentStart, segmentEnd - segmentStart);
+        segmentStart = segmentEnd;
+    }
+
+    previousBlockStartMs = blockStartMs;
+
+    // Index whatever segments the write head just completed
+    if (! freezeMode)
+    {
+        KANNEN_PROFILE_SCOPE("captureIndex");
+        captureIndexes[Grain::mainInput].update(captures[Grain::mainInput], delayLineWritePosition);
+
+        if (sidechainEnabled)
+            captureIndexes[Grain::sidechainInput].update(captures[Grain::sidechainInput], delayLineWritePosition);
+    }
+
+    // Switch engines around the overlap crossover, with some hysteresis so we don't flap
+    auto overlap = getExpectedGrainOverlap();
+    if (! spectralEngineActive && overlap >= spectralCrossoverOverlap)
+    {
+        if (! spectralGain.isSmoothing() && spectralGain.getCurrentValue() == 0.0f)
+            spectralGranulator.reset();
+
+        spectralEngineActive = true;
+    }
+    else if (spectralEngineActive && overlap < 0.75f * spectralCrossoverOverlap)
+    {
+        spectralEngineActive = false;
+
+        if (activeGrains.isEmpty())
+            prefillGrains();
+    }
+
+    spectralGain.setTargetValue(spectralEngineActive ? 1.0f : 0.0f);
+
+    if (spectralEngineActive || spectralGain.isSmoothing())
+    {
+        KANNEN_PROFILE_SCOPE("spectralEngine");
+
+        // The level follows the overlap up to the crossover and holds there, as the grain
+        // bus does: its density is capped at the crossover too
+        spectralGranulator.setGrainShape(static_cast<GrainKernels::EnvelopeShape>(static_cast<int>(getControl(envelopeShapeControl))),
+                                         getControl(stereoLinkControl) >= 0.5f);
+        spectralGranulator.setParameters(pow(2.0f, getControl(pitchShiftControl) / 12.0f),
+                                         (getControl(grainSizeControl) / 1000.0f) * (float) currentSampleRate,
+                                         juce::jmin(1.0f, overlap / 128.0f),
+                                         getControl(filterCutoffControl),
+                                         juce::jmin(overlap, spectralCrossoverOverlap));
+        spectralGranulator.setPlacement(static_cast<CaptureIndex::Placement>(static_cast<int>(getControl(grainPlacementControl))),
+                                        getControl(placementCentroidControl));
+
+        SpectralGranulator::FrameSource mainSource { captures[Grain::mainInput], captureIndexes[Grain::mainInput] };
+        SpectralGranulator::FrameSource sidechainSource { captures[Grain::sidechainInput], captureIndexes[Grain::sidechainInput] };
+
+        auto* const* grainBus = buffer.getArrayOfWritePointers();
+        auto* const* spectralBus = spectralBuffer.getArrayOfReadPointers();
+        auto numSpectralChannels = juce::jmin(totalNumOutputChannels, spectralBuffer.getNumChannels());
+
+        // Hosts may send blocks larger than they prepared for, so render in chunks
+        // of the prepared size rather than resize the buffer on the audio thread
+        for (int chunkStart = 0; chunkStart < numSamples; chunkStart += spectralBuffer.getNumSamples())
+        {
+            auto chunkLength = juce::jmin(spectralBuffer.getNumSamples(), numSamples - chunkStart);
+
+            spectralGranulator.process(mainSource,
+                                       sidechainEnabled ? &sidechainSource : nullptr,
+                                       getControl(sidechainMixControl),
+                                       spectralBuffer, chunkLength);
+
+            // Equal-power crossfade: the two engines are uncorrelated, so their powers add
+            for (int i = chunkStart; i < chunkStart + chunkLength; ++i)
+            {
+                auto mix = spectralGain.getNextValue();
+                auto grainLevel = std::sqrt(1.0f - mix);
+                auto spectralLevel = std::sqrt(mix);
+
+                for (int outChan = 0; outChan < numSpectralChannels; ++outChan)
+                    grainBus[outChan][i] = grainBus[outChan][i] * grainLevel + spectralBus[outChan][i - chunkStart] * spectralLevel;
+            }
+        }
+
+        // Once the grain bus is fully faded out its grains are inaudible; drop them
+        // rather than render them to silence
+        if (spectralEngineActive && ! spectralGain.isSmoothing())
+        {
+            for (auto& grain : activeGrains)
+                if (grain.cacheSlot >= 0)
+                    frozenGrainCache.release(grain.cacheSlot);
+
+            activeGrains.clearQuick();
+            grainsToSchedule = 0.0f;
+        }
+    }
+
+    publishRenderedControls();
+}
+
+void KannenGranularEngineAudioProcessor::publishRenderedControls()
+{
+    renderedFreeze = getControl(freezeControl) >= 0.5f;
+    renderedFeedback = getControl(feedbackControl);
+    renderedGrainSize = getControl(grainSizeControl);
+}
+
+void KannenGranularEngineAudioProcessor::renderSegment(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
     // Update filter if needed
-    if (*filterCutoffParam != lastFilterCutoff)
+    if (getControl(filterCutoffControl) != lastFilterCutoff)
     {
-        grainFilter.setCoefficients(juce::IIRCoefficients::makeLowPass(currentSampleRate, *filterCutoffParam));
-        lastFilterCutoff = *filterCutoffParam;
+        KANNEN_PROFILE_SCOPE("filterUpdate");
+
+        for (auto& filter : grainFilters)
+            filter.setCoefficients(juce::IIRCoefficients::makeLowPass(currentSampleRate, getControl(filterCutoffControl)));
+
+        lastFilterCutoff = getControl(filterCutoffControl);
     }
 
-    // Write input to delay line with feedback
-    for (int channel = 0; channel < totalNumInputChannels; ++channel)
+    // Freeze holds the captured audio in place. Cached grains only stay valid
+    // for as long as the material they were rendered from does.
+    bool shouldFreeze = getControl(freezeControl) >= 0.5f;
+    if (shouldFreeze != freezeMode)
+        frozenGrainCache.setFrozen(shouldFreeze);
+
+    freezeMode = shouldFreeze;
+
+    // Just after an unfreeze the cache worker may still be rendering from the capture;
+    // keep it held (for a segment or two at most) until the worker lets go
+    bool captureHeld = freezeMode || frozenGrainCache.isReadingCapture();
+
+    if (! captureHeld)
     {
-        const float* input = buffer.getReadPointer(channel);
-        float* delayData = delayLine.getWritePointer(channel);
-        int writePos = delayLineWritePosition;
+        // Both captures are written before the output overwrites the input channels
+        float segmentPeak = writeToDelayLine(captures[Grain::mainInput], getBusBuffer(buffer, true, 0), startSample, numSamples);
+
+        if (sidechainEnabled)
+            segmentPeak = juce::jmax(segmentPeak, writeToDelayLine(captures[Grain::sidechainInput], getBusBuffer(buffer, true, 1), startSample, numSamples));
 
-        for (int i = 0; i < numSamples; ++i)
+        // Once the write head wraps, everything written before this segment has
+        // been overwritten or is covered by the previous pass
+        currentPassPeak = juce::jmax(currentPassPeak, segmentPeak);
+
+        if (delayLineWritePosition + numSamples >= captures[Grain::mainInput].getNumFrames())
         {
-            float feedbackSample = delayData[(writePos + i) % delayLine.getNumSamples()];
-            delayData[(writePos + i) % delayLine.getNumSamples()] = input[i] + feedbackSample * *feedbackParam;
+            previousPassPeak = currentPassPeak;
+            currentPassPeak = segmentPeak;
         }
     }
 
     // Clear output buffer
-    buffer.clear();
+    buffer.clear(startSample, numSamples);
+
+    renderGrains(buffer, startSample, numSamples);
+
+    // Schedule new grains for the next segment. Scheduling carries on while the
+    // engines crossfade, so the grain bus keeps its level as it fades out.
+    if (! spectralEngineActive || spectralGain.isSmoothing())
+        scheduleGrains(numSamples);
+
+    // Remove expired grains
+    {
+        KANNEN_PROFILE_SCOPE("grainExpiry");
+
+        for (int g = activeGrains.size(); --g >= 0;)
+        {
+            if (activeGrains[g].age >= activeGrains[g].duration)
+            {
+                if (activeGrains[g].cacheSlot >= 0)
+                    frozenGrainCache.release(activeGrains[g].cacheSlot);
+
+                activeGrains.remove(g);
+            }
+        }
+    }
+
+    // Update delay line write position
+    if (! captureHeld)
+        delayLineWritePosition = (delayLineWritePosition + numSamples) % captures[Grain::mainInput].getNumFrames();
+}
+
+float KannenGranularEngineAudioProcessor::writeToDelayLine(CaptureBuffer& capture, const juce::AudioBuffer<float>& input, int startSample, int numSamples)
+{
+    // Write input to delay line with feedback
+    auto feedback = getControl(feedbackControl);
+    float segmentPeak = 0.0f;
+
+    auto numInputs = juce::jmin(input.getNumChannels(), CaptureBuffer::numChannels);
+    if (numInputs == 0)
+        return segmentPeak;
+
+    // A mono input fills both sides of each frame so stereo-linked grains still hear it
+    const float* inputData[CaptureBuffer::numChannels];
+    for (int channel = 0; channel < CaptureBuffer::numChannels; ++channel)
+        inputData[channel] = input.getReadPointer(juce::jmin(channel, numInputs - 1), startSample);
+
+    float* frames = capture.getWriteFrames();
+    int numFrames = capture.getNumFrames();
 
-    // Process each sample
     for (int i = 0; i < numSamples; ++i)
     {
-        // Process each grain
-        for (int g = 0; g < activeGrains.size(); ++g)
+        float* frame = frames + ((delayLineWritePosition + i) % numFrames) * CaptureBuffer::numChannels;
+
+        for (int channel = 0; channel < CaptureBuffer::numChannels; ++channel)
         {
-            auto& grain = activeGrains.getReference(g);
-            if (grain.age >= grain.duration)
+            float written = inputData[channel][i] + frame[channel] * feedback;
+            frame[channel] = written;
+            segmentPeak = juce::jmax(segmentPeak, std::abs(written));
+        }
+    }
+
+    return segmentPeak;
+}
+
+void KannenGranularEngineAudioProcessor::renderGrains(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    KANNEN_PROFILE_SCOPE("renderGrains");
+
+    auto numOutputs = juce::jmin(getTotalNumOutputChannels(), (int) grainFilters.size());
+
+    float* outputs[2] = {};
+    for (int outChan = 0; outChan < numOutputs; ++outChan)
+        outputs[outChan] = buffer.getWritePointer(outChan, startSample);
+
+    GrainKernels::RenderContext context;
+    context.sourceLength = captures[Grain::mainInput].getNumFrames(); // both captures are the same length
+    context.outputs = outputs;
+    context.numSamples = numSamples;
+    context.envelopeTable = envelopeTable.get();
+
+    // Each grain picks its specialised kernel once and renders the whole segment in one go
+    for (auto& grain : activeGrains)
+    {
+        if (grain.cacheSlot >= 0)
+        {
+            // Pre-rendered: just mix it in with the channel gains
+            auto numToMix = juce::jmin(numSamples, (int) std::ceil(grain.duration - grain.age));
+            if (numToMix <= 0)
                 continue;
 
-            // Calculate envelope
-            float envelope = 0.5f * (1.0f + cosf(juce::MathConstants<float>::pi * grain.age / grain.duration));
-
-            // Read from delay line with interpolation
-            int channel = grain.startChannel;
-            const float* delayData = delayLine.getReadPointer(channel);
-            int pos = static_cast<int>(grain.position);
-            float frac = grain.position - pos;
-            float sample1 = delayData[pos % delayLine.getNumSamples()];
-            float sample2 = delayData[(pos + 1) % delayLine.getNumSamples()];
-            float interpolated = sample1 + frac * (sample2 - sample1);
-
-            // Apply envelope and pitch
-            interpolated *= envelope;
-
-            // Apply filter
-            interpolated = grainFilter.processSingleSampleRaw(interpolated);
-
-            // Add to output
-            for (int outChan = 0; outChan < totalNumOutputChannels; ++outChan)
-                buffer.addSample(outChan, i, interpolated * (outChan == channel ? 1.0f : 0.5f));
-
-            // Update grain position and age
-            grain.position += grain.pitch * grain.playbackDirection;
-            grain.age += 1.0f;
-
-            // Wrap position
-            if (grain.position >= delayLine.getNumSamples())
-                grain.position -= delayLine.getNumSamples();
-            else if (grain.position < 0)
-                grain.position += delayLine.getNumSamples();
+            for (int outChan = 0; outChan < numOutputs; ++outChan)
+            {
+                if (grain.stereoLinked)
+                {
+                    // Left and right were cached separately; fold them together for a mono output
+                    for (int cachedChan = 0; cachedChan < CaptureBuffer::numChannels; ++cachedChan)
+                        if (numOutputs == 1 || cachedChan == outChan)
+                            juce::FloatVectorOperations::addWithMultiply(outputs[outChan], frozenGrainCache.getSamples(grain.cacheSlot, cachedChan) + (int) grain.age,
+                                                                         numOutputs == 1 ? 0.5f : 1.0f, numToMix);
+                }
+                else
+                {
+                    // Same gains as the kernels: a mono output is always the grain's own channel
+                    juce::FloatVectorOperations::addWithMultiply(outputs[outChan], frozenGrainCache.getSamples(grain.cacheSlot, 0) + (int) grain.age,
+                                                                 numOutputs == 1 || outChan == grain.startChannel ? 1.0f : 0.5f, numToMix);
+                }
+            }
+
+            grain.age += (float) numToMix;
+            continue;
         }
-    }
 
-    // Schedule new grains for next block
-    scheduleGrains();
+        // Read straight from whichever capture the grain was given
+        context.source = captures[(size_t) grain.source].getFrames();
 
-    // Remove expired grains
-    for (int g = activeGrains.size(); --g >= 0;)
-        if (activeGrains[g].age >= activeGrains[g].duration)
-            activeGrains.remove(g);
+        auto kernel = GrainKernels::getKernel(static_cast<GrainKernels::Interpolation>(grain.interpolation),
+                                              static_cast<GrainKernels::EnvelopeShape>(grain.envelopeShape),
+                                              grain.playbackDirection, grain.stereoLinked, numOutputs);
+        kernel(grain, context);
+    }
 
-    // Update delay line write position
-    delayLineWritePosition = (delayLineWritePosition + numSamples) % delayLine.getNumSamples();
+    // Apply filter
+    for (int outChan = 0; outChan < numOutputs; ++outChan)
+        grainFilters[(size_t) outChan].processSamples(outputs[outChan], numSamples);
 }
 
 float KannenGranularEngineAudioProcessor::applyStereoPan(float sample, float pan, bool isLeft)
@@ -272,6 +788,50 @@ float KannenGranularEngineAudioProcessor::applyFilter(float sample, juce::IIRFil
     return filter.processSingleSampleRaw(sample);
 }
 
+OscControlReceiver::Settings KannenGranularEngineAudioProcessor::getOscSettings() const
+{
+    OscControlReceiver::Settings settings;
+    auto oscState = parameters.state.getChildWithName(oscStateType);
+
+    settings.enabled = oscState.getProperty(oscEnabledID, settings.enabled);
+    settings.port = oscState.getProperty(oscPortID, settings.port);
+    settings.instanceName = oscState.getProperty(oscInstanceID, settings.instanceName);
+    settings.localOnly = oscState.getProperty(oscLocalOnlyID, settings.localOnly);
+    return settings;
+}
+
+void KannenGranularEngineAudioProcessor::setOscSettings(const OscControlReceiver::Settings& settings)
+{
+    auto oscState = parameters.state.getOrCreateChildWithName(oscStateType, nullptr);
+
+    oscState.setProperty(oscEnabledID, settings.enabled, nullptr);
+    oscState.setProperty(oscPortID, juce::jlimit(1, 65535, settings.port), nullptr);
+    oscState.setProperty(oscInstanceID, settings.instanceName.trim(), nullptr);
+    oscState.setProperty(oscLocalOnlyID, settings.localOnly, nullptr);
+
+    applyOscSettings();
+}
+
+void KannenGranularEngineAudioProcessor::applyOscSettings()
+{
+    auto settings = getOscSettings();
+
+    if (prepared && settings.enabled)
+        oscReceiver.connect(settings);
+    else
+        oscReceiver.disconnect();
+}
+
+bool KannenGranularEngineAudioProcessor::writeProfileTrace(const juce::File& file) const
+{
+   #if KANNEN_ENABLE_PROFILING
+    return Profiler::writeChromeTrace(file);
+   #else
+    juce::ignoreUnused(file);
+    return false;
+   #endif
+}
+
 //==============================================================================
 bool KannenGranularEngineAudioProcessor::hasEditor() const
 {
@@ -286,15 +846,20 @@ juce::AudioProcessorEditor* KannenGranularEngineAudioProcessor::createEditor()
 //==============================================================================
 void KannenGranularEngineAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    // Parameters and the OSC settings, as XML
+    auto state = parameters.copyState();
+    if (auto xml = state.createXml())
+        copyXmlToBinary(*xml, destData);
 }
 
 void KannenGranularEngineAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    auto xml = getXmlFromBinary(data, sizeInBytes);
+    if (xml == nullptr || ! xml->hasTagName(parameters.state.getType()))
+        return;
+
+    parameters.replaceState(juce::ValueTree::fromXml(*xml));
+    applyOscSettings();
 }
 
 //==============================================================================
@@ -9,6 +9,15 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "CaptureBuffer.h"
+#include "SpectralGranulator.h"
+#include "CaptureIndex.h"
+#include "OscControlReceiver.h"
+#include "SharedDspTables.h"
+#include "GrainKernels.h"
+#include "FrozenGrainCache.h"
+#include "Profiler.h"
+#include "AudioThreadGuard.h"
 
 //==============================================================================
 /**
@@ -53,28 +62,65 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
-    const juce::AudioBuffer<float>& getDelayBuffer() const { return delayLine; }
+    const CaptureBuffer& getDelayBuffer() const { return captures[Grain::mainInput]; }
+
+    /** Grains started since prepareToPlay(). Audio thread, or whoever calls processBlock(). */
+    juce::int64 getNumGrainsScheduled() const noexcept { return numGrainsScheduled; }
+
+    /** Writes the recorded profiling zones as a Chrome / Perfetto trace. Returns false
+        when built without KANNEN_ENABLE_PROFILING or the file can't be written. */
+    bool writeProfileTrace(const juce::File& file) const;
+
+    /** OSC remote control; off until enabled. Saved with the plugin state. Message thread only. */
+    OscControlReceiver::Settings getOscSettings() const;
+    void setOscSettings(const OscControlReceiver::Settings& settings);
+    bool isOscConnected() const { return oscReceiver.isConnected(); }
 
 private:
     // Sample Rate and Buffer
     double currentSampleRate;
-    juce::AudioBuffer<float> delayLine;
+    // One capture per input bus, both written the same way. They share the write
+    // position, so grains from the main input and the sidechain line up in time.
+    std::array<CaptureBuffer, Grain::numSources> captures; // interleaved stereo frames
+    bool sidechainEnabled = false;
     int delayLineWritePosition = 0;
 
-    struct Grain {
-    float position = 0.0f;
-    float age = 0.0f;
-    float duration = 0.0f;
-    float pitch = 1.0f;
-    int playbackDirection = 1;
-    int startChannel = 0;
-};
+    // Idle detection: peak written to the capture during the current and the
+    // previous pass of the write head bound everything the grains can read
+    static constexpr float silenceThreshold = 1.0e-5f; // -100 dBFS
+    float currentPassPeak = 0.0f, previousPassPeak = 0.0f;
+    bool idle = false;
+    std::array<CaptureIndex, Grain::numSources> captureIndexes;
 
-    std::vector<Grain> activeGrains;
+    // Preallocated, and never shrinks below that, so adding and removing grains never allocates
+    static constexpr int maxActiveGrains = 512;
+    juce::Array<Grain, juce::DummyCriticalSection, maxActiveGrains> activeGrains;
+
+    // Per-instance so the grain stream only depends on the input and the seed
+    static constexpr juce::int64 grainRandomSeed = 0x6b616e6e656eLL;
+    juce::Random grainRandom;
+    float grainsToSchedule = 0.0f; // fractional grains carried between segments
+    juce::int64 numGrainsScheduled = 0;
+
+    // Read-only tables shared with every other instance in the process
+    static constexpr int envelopeTableSize = 2049;
+    juce::SharedResourcePointer<SharedDspTables> sharedTables;
+    std::shared_ptr<const DspTable> envelopeTable;
+
+    // Pre-rendered grains of the frozen capture
+    FrozenGrainCache frozenGrainCache;
 
     // Grain Generation Functions
-    void scheduleGrains();
-    float generateEnvelope(const Grain& grain, int envelopeType);
+    void scheduleGrains(int numSamples);
+    void prefillGrains();
+    bool startGrain(float age);
+    float writeToDelayLine(CaptureBuffer& capture, const juce::AudioBuffer<float>& input, int startSample, int numSamples);
+    void renderSegment(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    void renderGrains(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    float getGrainDensity() const;
+    float getTimeDomainGrainDensity() const;
+    float getExpectedGrainOverlap() const;
+    bool isCaptureSilent() const;
     float applyFilter(float sample, juce::IIRFilter& filter);
     float applyStereoPan(float sample, float pan, bool isLeft);
 
@@ -86,6 +132,61 @@ private:
     std::atomic<float>* feedbackParam = nullptr;
     std::atomic<float>* freezeParam = nullptr;
     std::atomic<float>* filterCutoffParam = nullptr;
+    std::atomic<float>* grainPlacementParam = nullptr;
+    std::atomic<float>* placementCentroidParam = nullptr;
+    std::atomic<float>* envelopeShapeParam = nullptr;
+    std::atomic<float>* interpolationParam = nullptr;
+    std::atomic<float>* stereoLinkParam = nullptr;
+    std::atomic<float>* sidechainMixParam = nullptr;
+    std::atomic<float>* densityMultiplierParam = nullptr;
+
+    // Values the audio thread renders with: the host's, unless OSC has
+    // overridden them since the host last moved the parameter
+    enum ControlId
+    {
+        grainDensityControl,
+        grainSizeControl,
+        pitchShiftControl,
+        feedbackControl,
+        freezeControl,
+        filterCutoffControl,
+        grainPlacementControl,
+        placementCentroidControl,
+        envelopeShapeControl,
+        interpolationControl,
+        stereoLinkControl,
+        sidechainMixControl,
+        densityMultiplierControl,
+        numControls
+    };
+
+    void updateControlsFromHost();
+    void advanceHostRamps(float proportion);
+    void applyControlChange(int controlIndex, float value);
+    float getControl(ControlId id) const { return controlValues[id]; }
+
+    // Mirrors of the controls getTailLengthSeconds() needs, for the host's thread
+    void publishRenderedControls();
+    std::atomic<bool> renderedFreeze { false };
+    std::atomic<float> renderedFeedback { 0.0f }, renderedGrainSize { 0.0f };
+
+    std::array<std::atomic<float>*, numControls> controlParams {};
+    std::array<juce::NormalisableRange<float>, numControls> controlRanges;
+    std::array<float, numControls> controlValues {};
+    std::array<float, numControls> hostValuesAtOverride {};
+    std::array<bool, numControls> controlOverridden {};
+
+    // Host values are ramped across each block, rendered in segments of at least minSegmentLength
+    static constexpr int minSegmentLength = 32;
+    std::array<float, numControls> hostRampStart {};
+    std::array<float, numControls> hostRampEnd {};
+    bool hostRampActive = false;
+
+    // OSC remote control
+    OscControlReceiver oscReceiver;
+    bool prepared = false;
+    void applyOscSettings();
+    double previousBlockStartMs = 0.0;
 
     // Freeze and Modulation
     bool freezeMode = false;
@@ -101,7 +202,15 @@ private:
         }
     } pitchLFO, panLFO;
 
-    juce::IIRFilter grainFilter;
+    std::array<juce::IIRFilter, 2> grainFilters; // one per output channel, run on the summed grains
+    float lastFilterCutoff = 0.0f;
+
+    // Spectral engine, crossfaded with the grain bus around the overlap crossover
+    static constexpr float spectralCrossoverOverlap = 24.0f;
+    SpectralGranulator spectralGranulator;
+    juce::AudioBuffer<float> spectralBuffer;
+    juce::SmoothedValue<float> spectralGain;
+    bool spectralEngineActive = false;
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (KannenGranularEngineAudioProcessor)
 };
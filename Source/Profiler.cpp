@@ -0,0 +1,215 @@
+/*
+  ==============================================================================
+
+    Profiler.cpp
+    Opt-in scoped zone recording, dumpable as a Chrome / Perfetto trace.
+    Build with KANNEN_ENABLE_PROFILING=1 to enable; otherwise every zone
+    compiles to nothing.
+
+  ==============================================================================
+*/
+
+#include "Profiler.h"
+
+#if KANNEN_ENABLE_PROFILING
+
+namespace Profiler
+{
+    namespace
+    {
+        constexpr int maxThreads = 16;
+        constexpr int maxThreadNames = 64;      // threads that can be named in one dump
+        constexpr juce::uint32 eventsPerThread = 1 << 15;
+        constexpr double staleSeconds = 2.0;    // idle this long, a ring can be taken over
+
+        struct Event
+        {
+            const char* name;
+            juce::int64 startTicks, endTicks;
+            int threadSerial;
+        };
+
+        struct ThreadBuffer
+        {
+            std::array<Event, eventsPerThread> events;
+            std::atomic<juce::uint32> numWritten { 0 };
+            std::atomic<juce::int64> lastEndTicks { 0 };
+            std::atomic<int> threadSerial { -1 };   // owner's serial, -1 while never claimed
+        };
+
+        struct ThreadName
+        {
+            std::atomic<int> threadSerial { -1 };
+            char name[64] = {};
+        };
+
+        std::array<ThreadBuffer, maxThreads> threadBuffers;
+        std::array<ThreadName, maxThreadNames> threadNames;
+        std::atomic<int> nextThreadSerial { 0 };
+        std::atomic<int> numDroppedThreads { 0 };
+
+        // Plain pointers, so the first zone on a thread doesn't register anything with the
+        // C runtime to run at thread exit, which allocates on glibc and macOS
+        thread_local ThreadBuffer* ownBuffer = nullptr;
+        thread_local int ownSerial = -1;
+        thread_local bool countedAsDropped = false;
+
+        ThreadBuffer* findBufferToClaim (int& expectedSerial) noexcept
+        {
+            for (auto& buffer : threadBuffers)
+            {
+                expectedSerial = buffer.threadSerial.load (std::memory_order_relaxed);
+
+                if (expectedSerial < 0)
+                    return &buffer;
+            }
+
+            // Nothing is handed back when a thread exits, so take over the ring that has
+            // been idle longest: an audio thread that is still running writes every block
+            auto staleBefore = juce::Time::getHighResolutionTicks()
+                                 - (juce::int64) (staleSeconds * (double) juce::Time::getHighResolutionTicksPerSecond());
+            ThreadBuffer* oldest = nullptr;
+
+            for (auto& buffer : threadBuffers)
+            {
+                auto lastEnd = buffer.lastEndTicks.load (std::memory_order_relaxed);
+
+                if (lastEnd < staleBefore && (oldest == nullptr || lastEnd < oldest->lastEndTicks.load (std::memory_order_relaxed)))
+                    oldest = &buffer;
+            }
+
+            if (oldest != nullptr)
+                expectedSerial = oldest->threadSerial.load (std::memory_order_relaxed);
+
+            return oldest;
+        }
+
+        ThreadBuffer* claimThreadBuffer() noexcept
+        {
+            for (int attempt = 0; attempt < maxThreads; ++attempt)
+            {
+                int expectedSerial = -1;
+                auto* buffer = findBufferToClaim (expectedSerial);
+
+                if (buffer == nullptr)
+                    break;
+
+                // Every thread gets its own serial, even on a recycled buffer, so the
+                // zones the previous owner left behind keep their own track
+                auto serial = nextThreadSerial.fetch_add (1);
+
+                if (! buffer->threadSerial.compare_exchange_strong (expectedSerial, serial, std::memory_order_acq_rel))
+                    continue;
+
+                buffer->lastEndTicks.store (juce::Time::getHighResolutionTicks(), std::memory_order_relaxed);
+                ownSerial = serial;
+
+                auto& slot = threadNames[(size_t) (serial % maxThreadNames)];
+                slot.threadSerial.store (-1, std::memory_order_relaxed);
+
+                if (auto* thread = juce::Thread::getCurrentThread())
+                    thread->getThreadName().copyToUTF8 (slot.name, sizeof (slot.name));
+                else
+                    std::snprintf (slot.name, sizeof (slot.name), "Host thread %d", serial);
+
+                slot.threadSerial.store (serial, std::memory_order_release);
+                return buffer;
+            }
+
+            // Every ring is busy: this thread goes unrecorded until one goes stale
+            if (! countedAsDropped)
+            {
+                countedAsDropped = true;
+                ++numDroppedThreads;
+            }
+
+            return nullptr;
+        }
+
+        ThreadBuffer* getThreadBuffer() noexcept
+        {
+            // Claim a ring on the first zone, and another if this one was taken over
+            // while the thread sat idle
+            if (ownBuffer == nullptr || ownBuffer->threadSerial.load (std::memory_order_acquire) != ownSerial)
+                ownBuffer = claimThreadBuffer();
+
+            return ownBuffer;
+        }
+    }
+
+    //==============================================================================
+    ScopedZone::ScopedZone (const char* zoneName) noexcept
+        : name (zoneName), startTicks (juce::Time::getHighResolutionTicks())
+    {
+    }
+
+    ScopedZone::~ScopedZone() noexcept
+    {
+        auto endTicks = juce::Time::getHighResolutionTicks();
+
+        if (auto* buffer = getThreadBuffer())
+        {
+            // An increment rather than a store, in case a ring is taken over mid-zone
+            auto index = buffer->numWritten.fetch_add (1, std::memory_order_acq_rel);
+            buffer->events[index % eventsPerThread] = { name, startTicks, endTicks, ownSerial };
+            buffer->lastEndTicks.store (endTicks, std::memory_order_relaxed);
+        }
+    }
+
+    //==============================================================================
+    bool writeChromeTrace (const juce::File& file)
+    {
+        auto microsecondsPerTick = 1.0e6 / (double) juce::Time::getHighResolutionTicksPerSecond();
+
+        juce::MemoryOutputStream json;
+        json << "{\"traceEvents\":[";
+
+        auto first = true;
+        auto separator = [&]
+        {
+            if (! first)
+                json << ",\n";
+
+            first = false;
+        };
+
+        for (auto& slot : threadNames)
+        {
+            auto serial = slot.threadSerial.load (std::memory_order_acquire);
+            if (serial < 0)
+                continue;
+
+            separator();
+            json << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << serial
+                 << ",\"args\":{\"name\":" << juce::JSON::toString (juce::String::fromUTF8 (slot.name)) << "}}";
+        }
+
+        for (auto& buffer : threadBuffers)
+        {
+            auto numWritten = buffer.numWritten.load (std::memory_order_acquire);
+            auto numAvailable = juce::jmin (numWritten, eventsPerThread);
+
+            for (auto i = numWritten - numAvailable; i != numWritten; ++i)
+            {
+                auto& event = buffer.events[i % eventsPerThread];
+
+                separator();
+                json << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadSerial
+                     << ",\"ts\":" << juce::String ((double) event.startTicks * microsecondsPerTick, 3)
+                     << ",\"dur\":" << juce::String ((double) (event.endTicks - event.startTicks) * microsecondsPerTick, 3) << "}";
+            }
+        }
+
+        // Threads that found every buffer taken recorded nothing; say so rather than
+        // leave a trace that silently misses them
+        auto dropped = numDroppedThreads.load();
+        json << "],\"otherData\":{\"droppedThreads\":" << dropped << "}}\n";
+
+        if (dropped > 0)
+            juce::Logger::writeToLog ("Profiler: " + juce::String (dropped) + " thread(s) found the buffer pool full and were not recorded");
+
+        return file.replaceWithData (json.getData(), json.getDataSize());
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+  ==============================================================================
+
+    Profiler.h
+    Opt-in scoped zone recording, dumpable as a Chrome / Perfetto trace.
+    Build with KANNEN_ENABLE_PROFILING=1 to enable; otherwise every zone
+    compiles to nothing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#ifndef KANNEN_ENABLE_PROFILING
+ #define KANNEN_ENABLE_PROFILING 0
+#endif
+
+#if KANNEN_ENABLE_PROFILING
+
+//==============================================================================
+/**
+    Each thread records into its own fixed-size ring, claimed from a static pool
+    the first time it opens a zone, so recording never locks or allocates. The
+    claim is held in a plain thread_local pointer, so it doesn't register a
+    thread-exit destructor either (which allocates on glibc and macOS).
+    Zone names must be string literals.
+
+    Rings aren't handed back when a thread exits. A thread that finds the pool
+    full takes over a ring nobody has written to for a couple of seconds, which
+    keeps the old zones until they're overwritten; if its owner was only idle,
+    it claims another ring when it records again. Threads that find no ring
+    aren't recorded; the dump says how many there were.
+*/
+namespace Profiler
+{
+    class ScopedZone
+    {
+    public:
+        explicit ScopedZone (const char* zoneName) noexcept;
+        ~ScopedZone() noexcept;
+
+    private:
+        const char* name;
+        juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedZone)
+    };
+
+    /** Writes every thread's most recent zones as Chrome trace event JSON.
+        Zones recorded while the dump runs may be torn; dump after the glitch,
+        not during a benchmark.
+    */
+    bool writeChromeTrace (const juce::File& file);
+}
+
+ #define KANNEN_PROFILE_SCOPE(zoneName)  const Profiler::ScopedZone JUCE_JOIN_MACRO (kannenProfileZone, __LINE__) (zoneName);
+
+#else
+
+ #define KANNEN_PROFILE_SCOPE(zoneName)
+
+#endif
@@ -0,0 +1,52 @@
+/*
+  ==============================================================================
+
+    SharedDspTables.cpp
+    Process-wide registry of read-only lookup tables, shared by every plugin
+    instance so the footprint stays flat however many instances are loaded.
+
+  ==============================================================================
+*/
+
+#include "SharedDspTables.h"
+
+//==============================================================================
+std::shared_ptr<const DspTable> SharedDspTables::getTable (TableType type, int size, double sampleRate)
+{
+    const juce::ScopedLock sl (lock);
+
+    auto& entry = tables[{ type, size, sampleRate }];
+
+    if (auto existing = entry.lock())
+        return existing;
+
+    auto table = std::make_shared<const DspTable> (generate (type, size, sampleRate));
+    entry = table;
+    return table;
+}
+
+std::vector<float> SharedDspTables::generate (TableType type, int size, double sampleRate)
+{
+    juce::ignoreUnused (sampleRate);
+
+    std::vector<float> values ((size_t) size);
+
+    switch (type)
+    {
+        case TableType::grainEnvelope:
+            for (int i = 0; i < size; ++i)
+                values[(size_t) i] = 0.5f * (1.0f + std::cos (juce::MathConstants<float>::pi * (float) i / (float) (size - 1)));
+            break;
+
+        case TableType::hannWindow:
+            for (int i = 0; i < size; ++i)
+                values[(size_t) i] = 0.5f - 0.5f * std::cos (juce::MathConstants<float>::twoPi * (float) i / (float) size);
+            break;
+
+        default:
+            jassertfalse;
+            break;
+    }
+
+    return values;
+}
@@ -0,0 +1,84 @@
+/*
+  ==============================================================================
+
+    SharedDspTables.h
+    Process-wide registry of read-only lookup tables, shared by every plugin
+    instance so the footprint stays flat however many instances are loaded.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/** An immutable table of samples. */
+class DspTable
+{
+public:
+    explicit DspTable (std::vector<float> valuesToUse)
+        : values (std::move (valuesToUse))
+    {
+        jassert (values.size() >= 2);
+    }
+
+    const float* getData() const noexcept   { return values.data(); }
+    int getSize() const noexcept            { return (int) values.size(); }
+
+    /** Linearly interpolated lookup, where 0 is the first entry and 1 the last. */
+    float getInterpolated (float proportion) const noexcept
+    {
+        auto position = juce::jlimit (0.0f, 1.0f, proportion) * (float) (values.size() - 1);
+        auto index = juce::jmin ((size_t) position, values.size() - 2);
+        auto frac = position - (float) index;
+
+        return values[index] + frac * (values[index + 1] - values[index]);
+    }
+
+private:
+    const std::vector<float> values;
+
+    JUCE_DECLARE_NON_COPYABLE (DspTable)
+};
+
+//==============================================================================
+/**
+    Builds tables on first request and hands out shared, read-only references.
+
+    Hold one through a juce::SharedResourcePointer so the registry lives as long
+    as any instance does. The registry only keeps weak references, so each table
+    is freed once the last instance using it lets go. Call getTable() from
+    prepareToPlay or a constructor, never from the audio thread: it takes a lock
+    and may allocate.
+*/
+class SharedDspTables
+{
+public:
+    enum class TableType
+    {
+        grainEnvelope,  // 0.5 * (1 + cos (pi * x)) over x in [0, 1]
+        hannWindow      // periodic Hann, one entry per sample
+    };
+
+    /** sampleRate is part of the key for tables that depend on it; pass 0 for those that don't. */
+    std::shared_ptr<const DspTable> getTable (TableType type, int size, double sampleRate = 0.0);
+
+private:
+    static std::vector<float> generate (TableType type, int size, double sampleRate);
+
+    struct Key
+    {
+        TableType type;
+        int size;
+        double sampleRate;
+
+        bool operator< (const Key& other) const noexcept
+        {
+            return std::tie (type, size, sampleRate) < std::tie (other.type, other.size, other.sampleRate);
+        }
+    };
+
+    juce::CriticalSection lock;
+    std::map<Key, std::weak_ptr<const DspTable>> tables;
+};
@@ -0,0 +1,358 @@
+/*
+  ==============================================================================
+
+    SpectralGranulator.cpp
+    FFT-based grain cloud engine. Used instead of the time-domain overlap-add
+    once so many grains overlap that rendering them one by one costs more
+    than a handful of FFTs per hop.
+
+  ==============================================================================
+*/
+
+#include "SpectralGranulator.h"
+#include "Profiler.h"
+
+namespace
+{
+    float wrapPhase (float phase) noexcept
+    {
+        constexpr auto pi = juce::MathConstants<float>::pi;
+        constexpr auto twoPi = juce::MathConstants<float>::twoPi;
+        return phase - twoPi * std::floor ((phase + pi) / twoPi);
+    }
+}
+
+//==============================================================================
+SpectralGranulator::SpectralGranulator()
+    : fft (fftOrder),
+      window (sharedTables->getTable (SharedDspTables::TableType::hannWindow, fftSize)),
+      envelopeTable (sharedTables->getTable (SharedDspTables::TableType::grainEnvelope, fftSize))
+{
+    analysisWindow.assign (fftSize, 0.0f);
+    binFilterGain.assign (numBins, 1.0f);
+    previousFrame.assign (2 * fftSize, 0.0f);
+    analysisFrame.assign (2 * fftSize, 0.0f);
+    shiftedMagnitude.assign (numBins, 0.0f);
+    shiftedFrequency.assign (numBins, 0.0f);
+    scatterPhase.assign (numBins, 0.0f);
+    scatterMagnitude.assign (numBins, 1.0f);
+
+    updateAnalysisWindow();
+}
+
+void SpectralGranulator::prepare (double sampleRate, int numChannels)
+{
+    currentSampleRate = sampleRate;
+    random.setSeed (randomSeed);
+    channels.resize ((size_t) numChannels);
+
+    for (auto& state : channels)
+    {
+        state.fftData.resize (2 * fftSize);
+        state.smoothedMagnitude.resize (numBins);
+        state.synthesisPhase.resize (numBins);
+        state.outputAccumulator.resize (fftSize);
+    }
+
+    updateFilterResponse();
+    reset();
+}
+
+void SpectralGranulator::reset()
+{
+    for (auto& state : channels)
+    {
+        std::fill (state.smoothedMagnitude.begin(), state.smoothedMagnitude.end(), 0.0f);
+        std::fill (state.synthesisPhase.begin(), state.synthesisPhase.end(), 0.0f);
+        std::fill (state.outputAccumulator.begin(), state.outputAccumulator.end(), 0.0f);
+    }
+
+    samplesUntilNextFrame = 0;
+}
+
+void SpectralGranulator::setParameters (float pitchRatio, float grainSizeSamples, float scatter,
+                                        float cutoffHz, float overlap)
+{
+    pitch = pitchRatio;
+    grainSize = juce::jmax (1.0f, grainSizeSamples);
+    scatterAmount = juce::jlimit (0.0f, 1.0f, scatter);
+    grainOverlap = juce::jmax (0.0f, overlap);
+
+    if (cutoffHz != cutoff)
+    {
+        cutoff = cutoffHz;
+        updateFilterResponse();
+    }
+
+    if (juce::jlimit (hopSize, fftSize, juce::roundToInt (grainSize)) != analysisWindowLength)
+        updateAnalysisWindow();
+}
+
+void SpectralGranulator::setGrainShape (GrainKernels::EnvelopeShape envelopeShape, bool stereoLinked)
+{
+    linked = stereoLinked;
+
+    if (envelopeShape != envelope)
+    {
+        envelope = envelopeShape;
+        updateAnalysisWindow();
+    }
+}
+
+void SpectralGranulator::setPlacement (CaptureIndex::Placement placementToUse, float centroidHz)
+{
+    placement = placementToUse;
+    placementCentroid = centroidHz;
+}
+
+void SpectralGranulator::updateFilterResponse()
+{
+    // Magnitude response of the 2nd order Butterworth low-pass used by the time-domain path
+    for (int k = 0; k < numBins; ++k)
+    {
+        auto ratio = (float) (k * currentSampleRate / fftSize) / cutoff;
+        binFilterGain[k] = 1.0f / std::sqrt (1.0f + ratio * ratio * ratio * ratio);
+    }
+}
+
+void SpectralGranulator::updateAnalysisWindow()
+{
+    // A frame is one grain: its envelope over the grain's length, or over the
+    // whole frame for longer grains, where only its start fits
+    analysisWindowLength = juce::jlimit (hopSize, fftSize, juce::roundToInt (grainSize));
+
+    double energy = 0.0;
+
+    for (int n = 0; n < fftSize; ++n)
+    {
+        auto proportion = (float) n / (float) analysisWindowLength;
+        auto value = 0.0f;
+
+        if (n < analysisWindowLength)
+        {
+            switch (envelope)
+            {
+                case GrainKernels::EnvelopeShape::linearDecay:  value = GrainKernels::LinearDecayEnvelope::get (proportion, *envelopeTable); break;
+                case GrainKernels::EnvelopeShape::flat:         value = GrainKernels::FlatEnvelope::get (proportion, *envelopeTable); break;
+                default:                                        value = GrainKernels::RaisedCosineEnvelope::get (proportion, *envelopeTable); break;
+            }
+        }
+
+        analysisWindow[(size_t) n] = value;
+        energy += (double) value * value;
+    }
+
+    envelopeMeanSquare = (float) (energy / analysisWindowLength);
+
+    // At the Hann window's energy (3/8 per sample), so the resynthesis keeps the
+    // level it had with Hann analysis and the envelope only comes in through the gain
+    auto scale = (float) std::sqrt (0.375 * fftSize / juce::jmax (energy, 1.0e-6));
+    juce::FloatVectorOperations::multiply (analysisWindow.data(), scale, fftSize);
+}
+
+//==============================================================================
+void SpectralGranulator::process (const FrameSource& source, const FrameSource* sidechain, float sidechainMix,
+                                  juce::AudioBuffer<float>& output, int numSamples)
+{
+    auto numChannels = juce::jmin (output.getNumChannels(), CaptureBuffer::numChannels, (int) channels.size());
+    int done = 0;
+
+    while (done < numSamples)
+    {
+        if (samplesUntilNextFrame == 0)
+        {
+            // Same choice scheduleGrains() makes per grain
+            synthesiseFrame (sidechain != nullptr && random.nextFloat() < sidechainMix ? *sidechain : source);
+            samplesUntilNextFrame = hopSize;
+        }
+
+        auto offset = hopSize - samplesUntilNextFrame;
+        auto numToCopy = juce::jmin (numSamples - done, samplesUntilNextFrame);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            juce::FloatVectorOperations::copy (output.getWritePointer (channel, done),
+                                               channels[(size_t) channel].outputAccumulator.data() + offset,
+                                               numToCopy);
+
+        for (int channel = numChannels; channel < output.getNumChannels(); ++channel)
+            output.clear (channel, done, numToCopy);
+
+        done += numToCopy;
+        samplesUntilNextFrame -= numToCopy;
+    }
+}
+
+void SpectralGranulator::analyseFrame (const CaptureBuffer& capture, int startPosition, int direction,
+                                       const float (&channelGains)[CaptureBuffer::numChannels], std::vector<float>& dest)
+{
+    const float* frames = capture.getFrames();
+    auto sourceLength = capture.getNumFrames();
+
+    for (int n = 0; n < analysisWindowLength; ++n)
+    {
+        auto index = ((startPosition + direction * n) % sourceLength + sourceLength) % sourceLength;
+        const float* frame = frames + index * CaptureBuffer::numChannels;
+
+        auto sample = 0.0f;
+        for (int channel = 0; channel < CaptureBuffer::numChannels; ++channel)
+            sample += frame[channel] * channelGains[channel];
+
+        dest[(size_t) n] = sample * analysisWindow[(size_t) n];
+    }
+
+    std::fill (dest.begin() + analysisWindowLength, dest.end(), 0.0f);
+    fft.performRealOnlyForwardTransform (dest.data(), true);
+}
+
+void SpectralGranulator::analyseShiftedSpectrum (const CaptureBuffer& capture, int startPosition, int direction,
+                                                 const float (&channelGains)[CaptureBuffer::numChannels])
+{
+    constexpr auto twoPi = juce::MathConstants<float>::twoPi;
+    constexpr auto expectedAdvance = twoPi * (float) hopSize / (float) fftSize;
+
+    // The second frame is a hop further along in the direction the grain plays
+    analyseFrame (capture, startPosition, direction, channelGains, previousFrame);
+    analyseFrame (capture, startPosition + direction * hopSize, direction, channelGains, analysisFrame);
+
+    std::fill (shiftedMagnitude.begin(), shiftedMagnitude.end(), 0.0f);
+    std::fill (shiftedFrequency.begin(), shiftedFrequency.end(), 0.0f);
+
+    // Phase vocoder: true per-hop phase advance of each bin, moved to the pitch-shifted bin
+    for (int k = 0; k < numBins; ++k)
+    {
+        auto re1 = previousFrame[(size_t) (2 * k)], im1 = previousFrame[(size_t) (2 * k + 1)];
+        auto re2 = analysisFrame[(size_t) (2 * k)], im2 = analysisFrame[(size_t) (2 * k + 1)];
+
+        auto binAdvance = (float) k * expectedAdvance;
+        auto deviation = wrapPhase (std::atan2 (im2, re2) - std::atan2 (im1, re1) - binAdvance);
+
+        auto target = juce::roundToInt ((float) k * pitch);
+        if (target < numBins)
+        {
+            shiftedMagnitude[(size_t) target] += std::sqrt (re2 * re2 + im2 * im2);
+            shiftedFrequency[(size_t) target] = (binAdvance + deviation) * pitch;
+        }
+    }
+}
+
+void SpectralGranulator::advancePhases (ChannelState& state)
+{
+    for (int k = 0; k < numBins; ++k)
+        state.synthesisPhase[(size_t) k] = wrapPhase (state.synthesisPhase[(size_t) k] + shiftedFrequency[(size_t) k]);
+}
+
+void SpectralGranulator::drawScatter()
+{
+    constexpr auto pi = juce::MathConstants<float>::pi;
+
+    for (int k = 0; k < numBins; ++k)
+    {
+        scatterPhase[(size_t) k] = scatterAmount * pi * (2.0f * random.nextFloat() - 1.0f);
+        scatterMagnitude[(size_t) k] = 1.0f + 0.5f * scatterAmount * (2.0f * random.nextFloat() - 1.0f);
+    }
+}
+
+void SpectralGranulator::synthesiseChannel (ChannelState& state, float level, float magnitudeFollow, float normalisation)
+{
+    for (int k = 0; k < numBins; ++k)
+    {
+        auto& magnitude = state.smoothedMagnitude[(size_t) k];
+        magnitude += magnitudeFollow * (shiftedMagnitude[(size_t) k] * level - magnitude);
+
+        auto scatteredPhase = state.synthesisPhase[(size_t) k] + scatterPhase[(size_t) k];
+        auto scatteredMagnitude = magnitude * binFilterGain[(size_t) k] * scatterMagnitude[(size_t) k];
+
+        state.fftData[(size_t) (2 * k)] = scatteredMagnitude * std::cos (scatteredPhase);
+        state.fftData[(size_t) (2 * k + 1)] = scatteredMagnitude * std::sin (scatteredPhase);
+    }
+
+    state.fftData[1] = 0.0f;
+    state.fftData[(size_t) (2 * (numBins - 1) + 1)] = 0.0f;
+
+    // Mirror the negative frequencies so the inverse transform is real
+    for (int k = numBins; k < fftSize; ++k)
+    {
+        state.fftData[(size_t) (2 * k)] = state.fftData[(size_t) (2 * (fftSize - k))];
+        state.fftData[(size_t) (2 * k + 1)] = -state.fftData[(size_t) (2 * (fftSize - k) + 1)];
+    }
+
+    fft.performRealOnlyInverseTransform (state.fftData.data());
+
+    for (int n = 0; n < fftSize; ++n)
+        state.outputAccumulator[(size_t) n] += state.fftData[(size_t) n] * window->getData()[n] * normalisation;
+}
+
+void SpectralGranulator::synthesiseFrame (const FrameSource& source)
+{
+    KANNEN_PROFILE_SCOPE ("spectralFrame");
+
+    auto sourceLength = source.capture.getNumFrames();
+
+    for (auto& state : channels)
+    {
+        std::copy (state.outputAccumulator.begin() + hopSize, state.outputAccumulator.end(), state.outputAccumulator.begin());
+        std::fill (state.outputAccumulator.end() - hopSize, state.outputAccumulator.end(), 0.0f);
+    }
+
+    if (sourceLength < fftSize + hopSize)
+        return;
+
+    // Same placement as scheduleGrains(), falling back to anywhere in the
+    // capture while the index has nothing that matches
+    auto startPosition = source.index.findPosition (placement, placementCentroid, random);
+
+    if (startPosition < 0)
+        startPosition = random.nextInt (sourceLength);
+
+    // Like the grains it stands for, a frame plays forwards or backwards at random
+    auto direction = random.nextBool() ? 1 : -1;
+
+    auto magnitudeFollow = juce::jlimit (0.05f, 1.0f, (float) hopSize / grainSize);
+
+    // Random-phase grains add in power, and so do the frames standing in for them:
+    // four overlapping frames, each at 3/8 of the analysed power after synthesis
+    // windowing, sum to 0.75 rather than the 1.5 a coherent resynthesis would
+    auto normalisation = std::sqrt (grainOverlap * envelopeMeanSquare) / 0.75f;
+
+    auto numOutputs = juce::jmin (CaptureBuffer::numChannels, (int) channels.size());
+
+    if (linked)
+    {
+        // Each output reads its own capture channel, or both folded together for a mono output
+        for (int channel = 0; channel < numOutputs; ++channel)
+        {
+            float channelGains[CaptureBuffer::numChannels];
+            for (int sourceChannel = 0; sourceChannel < CaptureBuffer::numChannels; ++sourceChannel)
+                channelGains[sourceChannel] = numOutputs == 1 ? 0.5f : (sourceChannel == channel ? 1.0f : 0.0f);
+
+            auto& state = channels[(size_t) channel];
+            analyseShiftedSpectrum (source.capture, startPosition, direction, channelGains);
+            advancePhases (state);
+            drawScatter();
+            synthesiseChannel (state, 1.0f, magnitudeFollow, normalisation);
+        }
+    }
+    else if (numOutputs > 0)
+    {
+        // One capture channel, at full level on its own side and half on the other.
+        // Both outputs carry the same grain, so they share its phases and scatter.
+        auto startChannel = random.nextInt (CaptureBuffer::numChannels);
+
+        float channelGains[CaptureBuffer::numChannels] = {};
+        channelGains[startChannel] = 1.0f;
+
+        analyseShiftedSpectrum (source.capture, startPosition, direction, channelGains);
+        advancePhases (channels[0]);
+        drawScatter();
+
+        for (int channel = 0; channel < numOutputs; ++channel)
+        {
+            auto& state = channels[(size_t) channel];
+
+            if (channel > 0)
+                std::copy (channels[0].synthesisPhase.begin(), channels[0].synthesisPhase.end(), state.synthesisPhase.begin());
+
+            synthesiseChannel (state, numOutputs == 1 || channel == startChannel ? 1.0f : 0.5f, magnitudeFollow, normalisation);
+        }
+    }
+}
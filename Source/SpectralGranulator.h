@@ -0,0 +1,134 @@
+/*
+  ==============================================================================
+
+    SpectralGranulator.h
+    FFT-based grain cloud engine. Used instead of the time-domain overlap-add
+    once so many grains overlap that rendering them one by one costs more
+    than a handful of FFTs per hop.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SharedDspTables.h"
+#include "CaptureBuffer.h"
+#include "CaptureIndex.h"
+#include "GrainKernels.h"
+
+//==============================================================================
+/**
+    Synthesises a dense grain cloud as a stream of STFT frames.
+
+    Every hop a frame is analysed at a position picked from the capture index
+    with the current placement mode (the same choice scheduleGrains() makes
+    per grain), its magnitudes are smoothed
+    into the running spectrum and its phases are advanced with a phase vocoder,
+    so a frozen or stretched capture costs the same per frame as a live one.
+    Random phase and magnitude scatter stand in for the decorrelation of many
+    overlapping grains.
+
+    Each frame stands in for a grain and is read the way one would be: forwards
+    or backwards at random, through the grain envelope, and from both capture
+    channels when stereo-linked or from one channel at full level on its own
+    side and half on the other when not. The level follows the overlap the way
+    random-phase grains add up, and the caller caps that overlap at the
+    crossover so a huge density can't blow the level up.
+*/
+class SpectralGranulator
+{
+public:
+    static constexpr int fftOrder = 11;
+    static constexpr int fftSize = 1 << fftOrder;
+    static constexpr int hopSize = fftSize / 4;
+    static constexpr int numBins = fftSize / 2 + 1;
+
+    SpectralGranulator();
+
+    void prepare (double sampleRate, int numChannels);
+    void reset();
+
+    /** pitchRatio is a playback rate, grainSizeSamples controls how quickly the
+        spectrum follows new analysis frames and scatter (0..1) how much random
+        phase/magnitude spread is applied to each synthesised frame. overlap is
+        the number of grains the cloud stands for at any moment; each adds the
+        mean square of its envelope to the output power.
+    */
+    void setParameters (float pitchRatio, float grainSizeSamples, float scatter,
+                        float cutoffHz, float overlap);
+
+    /** The envelope each frame is windowed with, and whether frames keep the
+        capture's stereo image, as set for the time-domain grains.
+    */
+    void setGrainShape (GrainKernels::EnvelopeShape envelopeShape, bool stereoLinked);
+
+    /** Where frames are analysed: uniformly, or on the onsets, loud segments or
+        spectral centroid found by the capture index.
+    */
+    void setPlacement (CaptureIndex::Placement placementToUse, float centroidHz);
+
+    /** A capture to analyse frames from, and the index used to place them in it. */
+    struct FrameSource
+    {
+        const CaptureBuffer& capture;
+        const CaptureIndex& index;
+    };
+
+    /** Overwrites the first numSamples of each output channel with the cloud
+        rendered from source. If a sidechain is given, each frame is analysed
+        from it instead with probability sidechainMix.
+    */
+    void process (const FrameSource& source, const FrameSource* sidechain, float sidechainMix,
+                  juce::AudioBuffer<float>& output, int numSamples);
+
+private:
+    struct ChannelState
+    {
+        std::vector<float> fftData;
+        std::vector<float> smoothedMagnitude, synthesisPhase;
+        std::vector<float> outputAccumulator;
+    };
+
+    void synthesiseFrame (const FrameSource& source);
+    void analyseShiftedSpectrum (const CaptureBuffer& capture, int startPosition, int direction,
+                                 const float (&channelGains)[CaptureBuffer::numChannels]);
+    void analyseFrame (const CaptureBuffer& capture, int startPosition, int direction,
+                       const float (&channelGains)[CaptureBuffer::numChannels], std::vector<float>& dest);
+    void advancePhases (ChannelState& state);
+    void drawScatter();
+    void synthesiseChannel (ChannelState& state, float level, float magnitudeFollow, float normalisation);
+    void updateFilterResponse();
+    void updateAnalysisWindow();
+
+    juce::SharedResourcePointer<SharedDspTables> sharedTables;
+    juce::dsp::FFT fft;
+    std::shared_ptr<const DspTable> window;   // periodic Hann, for synthesis
+    std::shared_ptr<const DspTable> envelopeTable;
+    std::vector<float> analysisWindow;        // the grain envelope, at the Hann window's energy
+    std::vector<float> binFilterGain;
+    std::vector<float> previousFrame, analysisFrame;
+    std::vector<float> shiftedMagnitude, shiftedFrequency;
+    std::vector<float> scatterPhase, scatterMagnitude;
+    std::vector<ChannelState> channels;
+
+    static constexpr juce::int64 randomSeed = 0x737065637472LL;
+    juce::Random random;
+
+    double currentSampleRate = 44100.0;
+    int samplesUntilNextFrame = 0;
+
+    float pitch = 1.0f;
+    float grainSize = 4410.0f;
+    float scatterAmount = 0.0f;
+    float cutoff = 5000.0f;
+    float grainOverlap = 1.0f;
+    GrainKernels::EnvelopeShape envelope = GrainKernels::EnvelopeShape::raisedCosine;
+    bool linked = false;
+    int analysisWindowLength = 0;
+    float envelopeMeanSquare = 0.375f;
+    CaptureIndex::Placement placement = CaptureIndex::Placement::random;
+    float placementCentroid = 1000.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpectralGranulator)
+};
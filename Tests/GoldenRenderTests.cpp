@@ -0,0 +1,406 @@
+/*
+  ==============================================================================
+
+    GoldenRenderTests.cpp
+    Renders a seeded input through each processing path offline and compares
+    the output, sample by sample, against a committed golden render.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <optional>
+#include "PluginProcessor.h"
+#include "TestOptions.h"
+
+namespace
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 512;
+    constexpr int numBlocks = 375;      // 4 seconds, two passes of the capture
+    constexpr int numSamples = blockSize * numBlocks;
+    constexpr int numOutputChannels = 2;
+    constexpr juce::int64 inputSeed = 0x676f6c64656eLL;
+
+    constexpr int goldenMagic = 0x444c474b;     // "KGLD"
+    constexpr int goldenVersion = 1;
+
+    //==============================================================================
+    /** Seeded input: a log sweep over noise on the left, noise bursts and clicks on
+        the right, and a slowly beating chord for the sidechain.
+    */
+    struct TestInput
+    {
+        juce::AudioBuffer<float> main { 2, numSamples }, sidechain { 2, numSamples };
+
+        TestInput()
+        {
+            juce::Random random (inputSeed);
+            auto sweepSeconds = (double) numSamples / sampleRate;
+            auto sweepPhase = 0.0;
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                auto t = (double) i / sampleRate;
+
+                auto sweepHz = 50.0 * std::pow (8000.0 / 50.0, t / sweepSeconds);
+                sweepPhase += juce::MathConstants<double>::twoPi * sweepHz / sampleRate;
+                main.setSample (0, i, 0.3f * (float) std::sin (sweepPhase) + 0.05f * (random.nextFloat() * 2.0f - 1.0f));
+
+                auto inBurst = std::fmod (t, 0.5) < 0.05;
+                auto onClick = i % (int) (sampleRate / 4) == (int) (sampleRate / 8);
+                main.setSample (1, i, (inBurst ? 0.3f * (random.nextFloat() * 2.0f - 1.0f) : 0.0f) + (onClick ? 0.8f : 0.0f));
+
+                auto beat = 0.5 + 0.5 * std::sin (juce::MathConstants<double>::twoPi * 0.7 * t);
+                for (int channel = 0; channel < 2; ++channel)
+                {
+                    auto detune = channel == 0 ? 1.0 : 1.003;
+                    auto chord = std::sin (juce::MathConstants<double>::twoPi * 220.0 * detune * t)
+                               + std::sin (juce::MathConstants<double>::twoPi * 277.18 * detune * t)
+                               + std::sin (juce::MathConstants<double>::twoPi * 329.63 * detune * t);
+                    sidechain.setSample (channel, i, (float) (0.15 * beat * chord));
+                }
+            }
+        }
+    };
+
+    //==============================================================================
+    /** Sets parameters in their own units, the way host automation would. */
+    class ParameterSetter
+    {
+    public:
+        explicit ParameterSetter (juce::AudioProcessor& processor)
+        {
+            for (auto* parameter : processor.getParameters())
+                if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*> (parameter))
+                    parameters.set (ranged->getParameterID(), ranged);
+        }
+
+        void set (const juce::String& parameterID, float value)
+        {
+            auto* parameter = parameters[parameterID];
+            jassert (parameter != nullptr);
+
+            if (parameter != nullptr)
+                parameter->setValueNotifyingHost (parameter->convertTo0to1 (value));
+        }
+
+    private:
+        juce::HashMap<juce::String, juce::RangedAudioParameter*> parameters;
+    };
+
+    struct RenderPath
+    {
+        const char* name;
+        float tolerance;        // largest absolute difference allowed per sample
+        bool useSidechain;
+        std::function<void (ParameterSetter&)> setup;
+        std::function<void (ParameterSetter&, int block)> automate;
+    };
+
+    /** The scalar time-domain paths must match their goldens exactly; regenerate the
+        goldens when the compiler or its floating-point flags change. The spectral paths
+        go through whichever FFT backend JUCE picked, so they get an epsilon.
+    */
+    std::vector<RenderPath> getRenderPaths()
+    {
+        return {
+            { "timeDomain", 0.0f, false, nullptr, nullptr },
+
+            { "cubicFlatPitched", 0.0f, false,
+              [] (auto& p) { p.set ("interpolation", 1); p.set ("envelopeShape", 2); p.set ("pitchShift", 7); },
+              nullptr },
+
+            { "spectral", 1.0e-3f, false,
+              [] (auto& p) { p.set ("grainDensity", 100); p.set ("densityMultiplier", 20); },
+              nullptr },
+
+            // Up through the crossover and back down, so both crossfades are covered
+            { "crossover", 1.0e-3f, false, nullptr,
+              [] (auto& p, int block)
+              {
+                  auto triangle = 1.0f - std::abs (2.0f * (float) block / (float) numBlocks - 1.0f);
+                  p.set ("densityMultiplier", 1.0f + 19.0f * triangle);
+              } },
+
+            { "frozen", 0.0f, false,
+              [] (auto& p) { p.set ("grainDensity", 60); p.set ("pitchShift", -5); },
+              [] (auto& p, int block) { if (block == numBlocks / 2) p.set ("freeze", 1); } },
+
+            { "stereoLink", 0.0f, false,
+              [] (auto& p) { p.set ("stereoLink", 1); },
+              nullptr },
+
+            { "sidechain", 0.0f, true,
+              [] (auto& p) { p.set ("sidechainMix", 0.5f); },
+              nullptr },
+
+            { "placement", 0.0f, false,
+              [] (auto& p) { p.set ("grainPlacement", 1); },
+              [] (auto& p, int block)
+              {
+                  if (block == numBlocks / 2)
+                  {
+                      p.set ("grainPlacement", 3);
+                      p.set ("placementCentroid", 2000.0f);
+                  }
+              } }
+        };
+    }
+
+    //==============================================================================
+    struct Render
+    {
+        juce::AudioBuffer<float> output { numOutputChannels, numSamples };
+        std::vector<juce::int64> grainsAfterBlock;  // grains started up to the end of each block
+    };
+
+    Render render (const RenderPath& path, const TestInput& input)
+    {
+        KannenGranularEngineAudioProcessor processor;
+
+        if (path.useSidechain)
+        {
+            auto layout = processor.getBusesLayout();
+            layout.inputBuses.getReference (1) = juce::AudioChannelSet::stereo();
+
+            auto sidechainEnabled = processor.setBusesLayout (layout);
+            jassert (sidechainEnabled);
+            juce::ignoreUnused (sidechainEnabled);
+        }
+
+        ParameterSetter parameters (processor);
+        if (path.setup != nullptr)
+            path.setup (parameters);
+
+        // Offline, so nothing depends on the frozen grain cache worker's timing
+        processor.setNonRealtime (true);
+        processor.setRateAndBufferSizeDetails (sampleRate, blockSize);
+        processor.prepareToPlay (sampleRate, blockSize);
+
+        auto numChannels = juce::jmax (processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        juce::AudioBuffer<float> buffer (numChannels, blockSize);
+        juce::MidiBuffer midi;
+
+        Render result;
+        result.grainsAfterBlock.reserve ((size_t) numBlocks);
+
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            if (path.automate != nullptr)
+                path.automate (parameters, block);
+
+            auto start = block * blockSize;
+            buffer.clear();
+
+            auto copyInput = [&] (const juce::AudioBuffer<float>& source, int busIndex)
+            {
+                auto bus = processor.getBusBuffer (buffer, true, busIndex);
+
+                for (int channel = 0; channel < bus.getNumChannels(); ++channel)
+                    bus.copyFrom (channel, 0, source, juce::jmin (channel, source.getNumChannels() - 1), start, blockSize);
+            };
+
+            copyInput (input.main, 0);
+
+            if (path.useSidechain)
+                copyInput (input.sidechain, 1);
+
+            processor.processBlock (buffer, midi);
+
+            for (int channel = 0; channel < numOutputChannels; ++channel)
+                result.output.copyFrom (channel, start, buffer, channel, 0, blockSize);
+
+            result.grainsAfterBlock.push_back (processor.getNumGrainsScheduled());
+        }
+
+        processor.releaseResources();
+        return result;
+    }
+
+    //==============================================================================
+    juce::File getGoldenFile (const RenderPath& path)
+    {
+        return juce::File (KANNEN_GOLDEN_DIR).getChildFile (juce::String (path.name) + ".golden");
+    }
+
+    // Little-endian whatever the platform, so goldens can be shared
+    bool writeGolden (const juce::File& file, const Render& render)
+    {
+        file.getParentDirectory().createDirectory();
+        file.deleteFile();
+
+        juce::FileOutputStream stream (file);
+        if (stream.failedToOpen())
+            return false;
+
+        stream.writeInt (goldenMagic);
+        stream.writeInt (goldenVersion);
+        stream.writeInt (numOutputChannels);
+        stream.writeInt (blockSize);
+        stream.writeInt (numBlocks);
+
+        for (auto grains : render.grainsAfterBlock)
+            stream.writeInt64 (grains);
+
+        for (int channel = 0; channel < numOutputChannels; ++channel)
+            for (int i = 0; i < numSamples; ++i)
+                stream.writeFloat (render.output.getSample (channel, i));
+
+        stream.flush();
+        return stream.getStatus().wasOk();
+    }
+
+    std::optional<Render> readGolden (const juce::File& file, juce::String& error)
+    {
+        juce::FileInputStream stream (file);
+        if (stream.failedToOpen())
+        {
+            error = "No golden render at " + file.getFullPathName();
+            return {};
+        }
+
+        constexpr juce::int64 expectedSize = 5 * sizeof (int) + numBlocks * sizeof (juce::int64)
+                                              + (juce::int64) numOutputChannels * numSamples * sizeof (float);
+
+        if (stream.getTotalLength() != expectedSize
+             || stream.readInt() != goldenMagic || stream.readInt() != goldenVersion
+             || stream.readInt() != numOutputChannels || stream.readInt() != blockSize || stream.readInt() != numBlocks)
+        {
+            error = file.getFullPathName() + " is from a different version of the test";
+            return {};
+        }
+
+        Render render;
+        for (int block = 0; block < numBlocks; ++block)
+            render.grainsAfterBlock.push_back (stream.readInt64());
+
+        for (int channel = 0; channel < numOutputChannels; ++channel)
+            for (int i = 0; i < numSamples; ++i)
+                render.output.setSample (channel, i, stream.readFloat());
+
+        return render;
+    }
+
+    //==============================================================================
+    /** Empty if the renders match, otherwise where and how they first diverge. */
+    juce::String compare (const Render& expected, const Render& actual, float tolerance)
+    {
+        int firstSample = -1, firstChannel = 0;
+        float largestDifference = 0.0f;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            for (int channel = 0; channel < numOutputChannels; ++channel)
+            {
+                auto difference = std::abs (expected.output.getSample (channel, i) - actual.output.getSample (channel, i));
+
+                // Written so a NaN counts as a divergence
+                if (! (difference <= tolerance))
+                {
+                    if (firstSample < 0)
+                    {
+                        firstSample = i;
+                        firstChannel = channel;
+                    }
+
+                    largestDifference = std::isnan (difference) ? difference : juce::jmax (largestDifference, difference);
+                }
+            }
+        }
+
+        int firstGrainBlock = -1;
+        for (int block = 0; block < numBlocks && firstGrainBlock < 0; ++block)
+            if (expected.grainsAfterBlock[(size_t) block] != actual.grainsAfterBlock[(size_t) block])
+                firstGrainBlock = block;
+
+        if (firstSample < 0 && firstGrainBlock < 0)
+            return {};
+
+        auto grainsBefore = [] (const Render& render, int block)  { return block > 0 ? render.grainsAfterBlock[(size_t) block - 1] : (juce::int64) 0; };
+        auto grainRange = [&] (const Render& render, int block)
+        {
+            auto first = grainsBefore (render, block) + 1, last = render.grainsAfterBlock[(size_t) block];
+            return last >= first ? "#" + juce::String (first) + " to #" + juce::String (last) : juce::String ("none");
+        };
+
+        juce::String report;
+
+        if (firstSample >= 0)
+        {
+            auto block = firstSample / blockSize;
+
+            report << "first diverging sample " << firstSample << " (block " << block << ", offset " << firstSample % blockSize
+                   << "), channel " << firstChannel
+                   << ": expected " << expected.output.getSample (firstChannel, firstSample)
+                   << ", got " << actual.output.getSample (firstChannel, firstSample)
+                   << "; tolerance " << tolerance << ", largest difference " << largestDifference << "\n"
+                   << "grains started in block " << block << ": expected " << grainRange (expected, block)
+                   << ", got " << grainRange (actual, block) << "\n";
+        }
+
+        if (firstGrainBlock >= 0)
+        {
+            report << "grain scheduling first differs in block " << firstGrainBlock
+                   << ": expected grains " << grainRange (expected, firstGrainBlock)
+                   << ", got " << grainRange (actual, firstGrainBlock) << "\n";
+        }
+
+        return report;
+    }
+}
+
+//==============================================================================
+class GoldenRenderTests  : public juce::UnitTest
+{
+public:
+    GoldenRenderTests()  : juce::UnitTest ("Golden renders", "Regression") {}
+
+    void runTest() override
+    {
+        TestInput input;
+
+        for (auto& path : getRenderPaths())
+        {
+            beginTest (path.name);
+
+            auto actual = render (path, input);
+
+            // Two renders in one process must match exactly, goldens or not
+            auto repeat = compare (actual, render (path, input), 0.0f);
+            expect (repeat.isEmpty(), juce::String (path.name) + " is not reproducible:\n" + repeat);
+
+            auto file = getGoldenFile (path);
+
+            if (TestOptions::updateGoldenFiles)
+            {
+                expect (writeGolden (file, actual), "Couldn't write " + file.getFullPathName());
+                logMessage ("Wrote " + file.getFullPathName());
+                continue;
+            }
+
+            juce::String error;
+            auto expected = readGolden (file, error);
+
+            // A checkout without goldens can't compare anything; that's reported as a skip,
+            // not a pass, so a missing file never hides a regression
+            if (! expected.has_value() && ! file.existsAsFile())
+            {
+                logMessage (error + " (run with --update-golden to create it)");
+                ++TestOptions::numMissingGoldenFiles;
+                continue;
+            }
+
+            if (! expected.has_value())
+            {
+                expect (false, error + " (run with --update-golden to regenerate it)");
+                continue;
+            }
+
+            auto report = compare (*expected, actual, path.tolerance);
+            expect (report.isEmpty(), juce::String (path.name) + " no longer matches its golden render:\n" + report);
+        }
+    }
+};
+
+static GoldenRenderTests goldenRenderTests;
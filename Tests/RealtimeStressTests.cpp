@@ -0,0 +1,213 @@
+/*
+  ==============================================================================
+
+    RealtimeStressTests.cpp
+    Drives the processor the way a busy host does: random block sizes, some
+    larger than it prepared for, random parameter automation and freeze
+    toggles, OSC traffic and a re-prepare at a new sample rate. Fails on any allocation, lock, wait or sleep the audio
+    thread guard sees inside processBlock.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "AudioThreadGuard.h"
+#include "PluginProcessor.h"
+
+namespace
+{
+    constexpr int maxBlockSize = 1024;
+    constexpr int maxHostBlockSize = 4 * maxBlockSize;  // some hosts send more than they prepared for
+    constexpr int numBlocks = 3000;
+    constexpr int oscPort = 19731;
+
+    juce::CriticalSection violationLock;
+    juce::StringArray violations;
+
+   #if KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+    // Runs outside the realtime section, so it's free to lock and allocate
+    void recordViolation (const juce::String& report)
+    {
+        const juce::ScopedLock sl (violationLock);
+        violations.add (report);
+    }
+   #endif
+
+    int getNumViolationsAndClear()
+    {
+        const juce::ScopedLock sl (violationLock);
+        auto numViolations = violations.size();
+        violations.clear();
+        return numViolations;
+    }
+}
+
+//==============================================================================
+class RealtimeStressTests  : public juce::UnitTest
+{
+public:
+    RealtimeStressTests()  : juce::UnitTest ("Realtime stress", "Realtime") {}
+
+    void runTest() override
+    {
+       #if KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+        AudioThreadGuard::setViolationHandler (recordViolation);
+
+        beginTest ("Guard sees JUCE containers and locks");
+        checkGuard();
+       #else
+        logMessage ("Built without KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS, so only the output is checked");
+       #endif
+
+        beginTest ("Main input only");
+        stress (false);
+
+        beginTest ("With sidechain");
+        stress (true);
+
+       #if KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+        AudioThreadGuard::setViolationHandler (nullptr);
+       #endif
+    }
+
+private:
+   #if KANNEN_TRAP_AUDIO_THREAD_ALLOCATIONS
+    // The stress runs only mean something if the guard would have caught these
+    void checkGuard()
+    {
+        getNumViolationsAndClear();
+
+        // HeapBlock reallocs behind operator new's back
+        juce::Array<int> array;
+        {
+            KANNEN_REALTIME_SECTION
+            for (int i = 0; i < 100; ++i)
+                array.add (i);
+        }
+
+        expectEquals (array.size(), 100);
+        expect (getNumViolationsAndClear() > 0, "Growing a juce::Array in a realtime section wasn't caught");
+
+        juce::AudioBuffer<float> audioBuffer (2, 64);
+        {
+            KANNEN_REALTIME_SECTION
+            audioBuffer.setSize (2, 4096, false, false, true);
+        }
+
+        expect (getNumViolationsAndClear() > 0, "Growing a juce::AudioBuffer in a realtime section wasn't caught");
+
+        juce::CriticalSection lock;
+        {
+            KANNEN_REALTIME_SECTION
+            const juce::ScopedLock sl (lock);
+        }
+
+        expect (getNumViolationsAndClear() > 0, "Taking a juce::CriticalSection in a realtime section wasn't caught");
+
+        // And nothing is reported outside one
+        array.addArray (array);
+        expectEquals (getNumViolationsAndClear(), 0, "Allocation outside a realtime section was reported");
+    }
+   #endif
+
+    void stress (bool useSidechain)
+    {
+        auto random = getRandom();
+
+        KannenGranularEngineAudioProcessor processor;
+
+        if (useSidechain)
+        {
+            auto layout = processor.getBusesLayout();
+            layout.inputBuses.getReference (1) = juce::AudioChannelSet::stereo();
+            expect (processor.setBusesLayout (layout), "Sidechain layout rejected");
+        }
+
+        // Connected on prepare. A busy port only leaves the OSC traffic out.
+        processor.setOscSettings ({ true, oscPort, "stress", true });
+
+        // Realtime, so the frozen grain cache worker renders alongside
+        processor.setNonRealtime (false);
+        prepare (processor, 48000.0);
+
+        juce::OSCSender oscSender;
+        auto sendOsc = processor.isOscConnected() && oscSender.connect ("127.0.0.1", oscPort);
+
+        if (! sendOsc)
+            logMessage ("Port " + juce::String (oscPort) + " is unavailable, so no OSC traffic is sent");
+
+        juce::Array<juce::RangedAudioParameter*> parameters;
+        for (auto* parameter : processor.getParameters())
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*> (parameter))
+                parameters.add (ranged);
+
+        auto numChannels = juce::jmax (processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        juce::AudioBuffer<float> buffer (numChannels, maxHostBlockSize);
+        juce::MidiBuffer midi;
+
+        getNumViolationsAndClear();
+
+        auto silent = false;
+        auto numNonFinite = 0;
+
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            // Hosts change sample rate by re-preparing, which the audio thread must survive
+            if (block == numBlocks / 2)
+            {
+                processor.releaseResources();
+                prepare (processor, 96000.0);
+            }
+
+            // Mostly anything up to the prepared size, with plenty of tiny blocks and the odd oversize one
+            auto blockSize = random.nextInt (4) == 0  ? 1 + random.nextInt (16)
+                           : random.nextInt (16) == 0 ? maxBlockSize + 1 + random.nextInt (maxHostBlockSize - maxBlockSize)
+                                                      : 1 + random.nextInt (maxBlockSize);
+
+            // Automation lands between blocks; freeze and the choice parameters toggle too
+            for (auto numChanges = random.nextInt (4); --numChanges >= 0;)
+                parameters[random.nextInt (parameters.size())]->setValueNotifyingHost (random.nextFloat());
+
+            if (sendOsc && random.nextInt (8) == 0)
+            {
+                auto* parameter = parameters[random.nextInt (parameters.size())];
+                oscSender.send (juce::OSCAddressPattern ("/kannen/stress/" + parameter->getParameterID()),
+                                parameter->convertFrom0to1 (random.nextFloat()));
+            }
+
+            // Silent stretches send the processor idle and wake it again
+            if (random.nextInt (40) == 0)
+                silent = ! silent;
+
+            juce::AudioBuffer<float> blockBuffer (buffer.getArrayOfWritePointers(), numChannels, blockSize);
+            blockBuffer.clear();
+
+            if (! silent)
+                for (int channel = 0; channel < processor.getTotalNumInputChannels(); ++channel)
+                    for (int i = 0; i < blockSize; ++i)
+                        blockBuffer.setSample (channel, i, 0.3f * (random.nextFloat() * 2.0f - 1.0f));
+
+            processor.processBlock (blockBuffer, midi);
+
+            for (int channel = 0; channel < processor.getTotalNumOutputChannels(); ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    if (! std::isfinite (blockBuffer.getSample (channel, i)))
+                        ++numNonFinite;
+        }
+
+        processor.releaseResources();
+
+        expectEquals (numNonFinite, 0, "Non-finite output samples");
+
+        const juce::ScopedLock sl (violationLock);
+        expect (violations.isEmpty(), juce::String (violations.size()) + " realtime violation(s) in processBlock, the first:\n" + violations[0]);
+    }
+
+    static void prepare (KannenGranularEngineAudioProcessor& processor, double sampleRate)
+    {
+        processor.setRateAndBufferSizeDetails (sampleRate, maxBlockSize);
+        processor.prepareToPlay (sampleRate, maxBlockSize);
+    }
+};
+
+static RealtimeStressTests realtimeStressTests;
@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+    TestMain.cpp
+    Runs every registered juce::UnitTest. Returns 1 on any failure, and
+    TestOptions::skippedExitCode if golden renders were missing but nothing failed.
+    With --trace, and built with KANNEN_ENABLE_PROFILING, the profiler zones
+    recorded during the run are written out as a Chrome / Perfetto trace.
+
+      KannenGranularEngineTests [--update-golden] [--category <name>] [--trace <file>]
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "TestOptions.h"
+#include "Profiler.h"
+
+bool TestOptions::updateGoldenFiles = false;
+int TestOptions::numMissingGoldenFiles = 0;
+
+// ArgumentList only reads "--option=value" for long options; take "--option value" too
+static juce::String getOptionValue (const juce::ArgumentList& arguments, juce::StringRef option)
+{
+    auto value = arguments.getValueForOption (option);
+    auto index = arguments.indexOfOption (option);
+
+    if (value.isEmpty() && index >= 0 && index + 1 < arguments.size() && ! arguments[index + 1].isOption())
+        value = arguments[index + 1].text;
+
+    return value;
+}
+
+int main (int argc, char* argv[])
+{
+    // The processor's parameter tree and editor expect a message manager
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::ArgumentList arguments (argc, argv);
+    TestOptions::updateGoldenFiles = arguments.containsOption ("--update-golden");
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure (false);
+
+    if (arguments.containsOption ("--category"))
+        runner.runTestsInCategory (getOptionValue (arguments, "--category"));
+    else
+        runner.runAllTests();
+
+    int numFailures = 0;
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        numFailures += runner.getResult (i)->failures;
+
+    if (arguments.containsOption ("--trace"))
+    {
+       #if KANNEN_ENABLE_PROFILING
+        auto tracePath = getOptionValue (arguments, "--trace");
+        auto traceFile = juce::File::getCurrentWorkingDirectory().getChildFile (tracePath);
+
+        if (tracePath.isEmpty() || ! Profiler::writeChromeTrace (traceFile))
+        {
+            juce::Logger::writeToLog ("Couldn't write the trace to \"" + tracePath + "\"");
+            return 1;
+        }
+
+        juce::Logger::writeToLog ("Wrote the profiler trace to " + traceFile.getFullPathName());
+       #else
+        juce::Logger::writeToLog ("Built without KANNEN_ENABLE_PROFILING, so there is no trace to write");
+       #endif
+    }
+
+    if (numFailures > 0)
+        return 1;
+
+    if (TestOptions::numMissingGoldenFiles > 0)
+    {
+        juce::Logger::writeToLog (juce::String (TestOptions::numMissingGoldenFiles) + " golden render(s) missing, so those comparisons were skipped");
+        return TestOptions::skippedExitCode;
+    }
+
+    return 0;
+}
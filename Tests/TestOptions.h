@@ -0,0 +1,23 @@
+/*
+  ==============================================================================
+
+    TestOptions.h
+    Command line options shared by the test cases.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+namespace TestOptions
+{
+    /** Set by --update-golden: write the golden renders instead of comparing against them. */
+    extern bool updateGoldenFiles;
+
+    /** Golden renders that weren't found. The run is reported as skipped if there were any
+        and nothing failed. */
+    extern int numMissingGoldenFiles;
+
+    /** Exit code for a run that skipped tests; ctest reads it through SKIP_RETURN_CODE. */
+    constexpr int skippedExitCode = 77;
+}